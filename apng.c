@@ -0,0 +1,504 @@
+#include "apng.h"
+#include "globalvars.h"
+#include "errorHandling.h"
+#include "fileHandling.h"
+#include "encoding.h"
+#include "pngChunks.h"
+#include "idatCodec.h"
+
+#define FCTL_LENGTH 26                          //length of the fcTL chunk data, in bytes
+#define SEQUENCE_LENGTH 4                       //length of the sequence number starting fcTL and fdAT data, in bytes
+#define FRAME_HEADER_LENGTH 12                  //length of the marker, payload size and frame count embedded into the first frame, in bytes
+#define FRAME_ENTRY_LENGTH 4                    //length of each frame table entry (the number of payload bytes held by one frame), in bytes
+
+
+typedef struct apngFrame
+{
+    int width,                                  //width of the frame in pixels
+        height;                                 //height of the frame in pixels
+    byteBuffer stream,                          //zlib stream carried by the frame's IDAT or fdAT chunks
+               output;                          //recompressed zlib stream, once the frame has been embedded into
+    unsigned char *pixels;                      //decoded pixel data while the frame is being worked on
+    unsigned char *data;                        //bytes to embed into the frame, or to extract from it
+    size_t dataLength;                          //number of bytes in data; frames with none are never decoded
+} apngFrame;
+
+typedef struct apngImage
+{
+    chunkFile file;                             //mapping of the APNG file
+    int channels,                               //number of color channels shared by every frame
+        count;                                  //number of frames, counting the default image
+    apngFrame *frames;                          //every image data stream of the file, in file order
+} apngImage;
+
+typedef struct frameJob
+{
+    apngImage *image;                           //image whose frames are being worked on
+    int embed,                                  //1 to embed each frame's data, 0 to extract it
+        next,                                   //index of the next frame for a worker to take
+        failed;                                 //index of a frame that could not be worked on, or -1
+    pthread_mutex_t lock;                       //guards next and failed
+} frameJob;
+
+
+//Stores "val" at "bytes" least significant byte first, so that its bits are embedded in the same order writebit uses.
+static void putFrameWord(unsigned char *bytes, uint32_t val)
+{
+    for (int b = 0; b < 4; b++)
+        bytes[b] = (val >> (b * BYTE_SIZE)) & 0xFF;
+}
+
+//Returns the 32-bit integer stored at "bytes" by putFrameWord.
+static uint32_t getFrameWord(const unsigned char *bytes)
+{
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+//Returns 1 if the file at "path" is an animated PNG, i.e. it has an acTL chunk before its image data.
+int isAPNG(const char *path)
+{
+    chunkFile file;
+    pngChunk chunk;
+    size_t offset = 0;
+    int animated = 0;
+
+    if (chunkOpen(path, &file) != 0)
+        return 0;
+
+    while (!animated && chunkNext(&file, &offset, &chunk) && strcmp(chunk.type, "IDAT") != 0)
+        animated = (strcmp(chunk.type, "acTL") == 0);
+
+    chunkClose(&file);
+    return animated;
+}
+
+//Maps the APNG file at "path" and collects the zlib stream and dimensions of each of its frames into "image", without decoding them.
+static void apngRead(const char *path, apngImage *image)
+{
+    pngChunk chunk;                             //chunk currently being read
+    size_t offset = 0;                          //offset of the next chunk to read
+    int bitDepth = 0, colorType = 0, interlace = 0,
+        imageWidth = 0, imageHeight = 0,        //dimensions given by IHDR, which every frame must fit within
+        frameWidth = 0, frameHeight = 0,        //dimensions given by the latest IHDR or fcTL chunk
+        newFrame = 1;                           //1 if the next IDAT or fdAT chunk starts a new frame
+
+
+
+    memset(image, 0, sizeof(*image));
+    if (chunkOpen(path, &image->file) != 0)
+        error_(1, "%s: [apngRead] '%s' is not a PNG file.", exeName, path);
+
+    while (chunkNext(&image->file, &offset, &chunk) && strcmp(chunk.type, "IEND") != 0)
+    {
+        if (strcmp(chunk.type, "IHDR") == 0 && chunk.length == 13)
+        {
+            frameWidth = imageWidth = getUint32(chunk.data);
+            frameHeight = imageHeight = getUint32(chunk.data + 4);
+            bitDepth = chunk.data[8];
+            colorType = chunk.data[9];
+            interlace = chunk.data[12];
+        }
+        else if (strcmp(chunk.type, "fcTL") == 0 && chunk.length == FCTL_LENGTH)
+        {
+            uint32_t width = getUint32(chunk.data + 4),
+                     height = getUint32(chunk.data + 8),
+                     x = getUint32(chunk.data + 12),
+                     y = getUint32(chunk.data + 16);
+
+            //a frame must lie within the image, as the APNG specification requires
+            if (width == 0 || height == 0 || (uint64_t)x + width > (uint64_t)imageWidth || (uint64_t)y + height > (uint64_t)imageHeight)
+                error_(1, "%s: [apngRead] Frame %d of '%s' does not fit within the image.", exeName, image->count, path);
+            frameWidth = width;
+            frameHeight = height;
+            newFrame = 1;
+        }
+        else if (strcmp(chunk.type, "IDAT") == 0 || (strcmp(chunk.type, "fdAT") == 0 && chunk.length >= SEQUENCE_LENGTH))
+        {
+            int fdAT = (chunk.type[0] == 'f');
+            apngFrame *frame;
+
+            //the first data chunk after IHDR or an fcTL chunk starts a new frame; the rest continue it
+            if (newFrame)
+            {
+                image->frames = realloc(image->frames, (image->count + 1) * sizeof(apngFrame));
+                frame = &image->frames[image->count++];
+                memset(frame, 0, sizeof(*frame));
+                frame->width = frameWidth;
+                frame->height = frameHeight;
+                newFrame = 0;
+            }
+            frame = &image->frames[image->count - 1];
+
+            bufferAppend(&frame->stream, chunk.data + (fdAT ? SEQUENCE_LENGTH : 0), chunk.length - (fdAT ? SEQUENCE_LENGTH : 0));
+        }
+    }
+
+    image->channels = colorChannels(colorType);
+    if (bitDepth != BYTE_SIZE)
+        error_(1, "%s: [apngRead] Bit depth does not equal 1 byte (8 bits).", exeName);
+    if (interlace || !image->channels || !image->count)
+        error_(1, "%s: [apngRead] '%s' is interlaced or has no usable frames.", exeName, path);
+    for (int i = 0; i < image->count; i++)
+        if (image->frames[i].width <= 0 || image->frames[i].height <= 0)
+            error_(1, "%s: [apngRead] Frame %d of '%s' has invalid dimensions.", exeName, i, path);
+}
+
+//Returns the number of bytes that can be embedded into the least significant bits of "frame".
+static size_t frameCapacity(const apngImage *image, const apngFrame *frame)
+{
+    return (size_t)frame->width * frame->height * image->channels / BYTE_SIZE;
+}
+
+//Inflates and unfilters the zlib stream of "frame" into frame->pixels.
+//Returns 0 on success, or -1 if the data cannot be decoded or there is not enough memory; it runs on worker threads, so it never exits.
+static int decodeFrame(const apngImage *image, apngFrame *frame)
+{
+    size_t rowlength = (size_t)frame->width * image->channels,
+           stride = rowlength + 1;
+    unsigned char *filtered = malloc(frame->height * stride);
+
+
+
+    frame->pixels = malloc(frame->height * rowlength);
+    if (!filtered || !frame->pixels || frame->stream.length < ZLIB_HEADER_LENGTH + ZLIB_TRAILER_LENGTH
+        || inflateRaw(frame->stream.data + ZLIB_HEADER_LENGTH, frame->stream.length - ZLIB_HEADER_LENGTH, filtered, frame->height * stride) != 0)
+    {
+        free(filtered);
+        return -1;
+    }
+
+    for (int y = 0; y < frame->height; y++)
+    {
+        unsigned char *row = frame->pixels + y * rowlength;
+
+        if (filtered[y * stride] > 4)
+        {
+            free(filtered);
+            return -1;
+        }
+        memcpy(row, filtered + y * stride + 1, rowlength);
+        unfilterRow(filtered[y * stride], row, y ? row - rowlength : NULL, rowlength, image->channels);
+    }
+
+    free(filtered);
+    return 0;
+}
+
+//Filters and compresses frame->pixels into a fresh zlib stream in frame->output. Returns 0 on success, or -1 if there is not enough memory.
+static int encodeFrame(const apngImage *image, apngFrame *frame)
+{
+    size_t rowlength = (size_t)frame->width * image->channels;
+    unsigned char **rows = malloc(frame->height * sizeof(unsigned char *));
+
+    if (!rows)
+        return -1;
+    for (int y = 0; y < frame->height; y++)
+        rows[y] = frame->pixels + y * rowlength;
+    compressStream(rows, frame->height, rowlength, image->channels, &frame->output);
+
+    free(rows);
+    return 0;
+}
+
+//Takes frames from "arg" (a frameJob) until none are left, embedding or extracting each one's data on its own.
+//A frame that cannot be worked on is recorded in the job, and stops every worker from taking further frames.
+static void *frameWorker(void *arg)
+{
+    frameJob *job = arg;
+
+    for (;;)
+    {
+        apngFrame *frame;
+        int index, failed;
+
+        pthread_mutex_lock(&job->lock);
+        index = job->failed == -1 ? job->next++ : job->image->count;
+        pthread_mutex_unlock(&job->lock);
+        if (index >= job->image->count)
+            return NULL;
+
+        //frames holding none of the payload keep their original compressed data
+        frame = &job->image->frames[index];
+        if (!frame->dataLength)
+            continue;
+
+        failed = decodeFrame(job->image, frame) != 0;
+        if (!failed && job->embed)
+        {
+            embedBytes(frame->pixels, frame->data, frame->dataLength);
+            failed = encodeFrame(job->image, frame) != 0;
+        }
+        else if (!failed)
+            extractBytes(frame->pixels, frame->data, frame->dataLength);
+
+        free(frame->pixels);
+        frame->pixels = NULL;
+
+        if (failed)
+        {
+            pthread_mutex_lock(&job->lock);
+            if (job->failed == -1)
+                job->failed = index;
+            pthread_mutex_unlock(&job->lock);
+            return NULL;
+        }
+    }
+}
+
+//Embeds (or extracts) the data of every frame of "image" on a pool of one worker per core.
+static void runFrames(apngImage *image, int embed)
+{
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int workers = cores < 1 ? 1 : (cores < image->count ? cores : image->count);
+    pthread_t *threads = malloc(workers * sizeof(pthread_t));
+    frameJob job = { image, embed, 0, -1 };
+    int started = 0;
+
+
+
+    pthread_mutex_init(&job.lock, NULL);
+    while (started < workers && pthread_create(&threads[started], NULL, frameWorker, &job) == 0)
+        started++;
+    //with no worker running at all, do the work on this thread instead
+    if (!started)
+        frameWorker(&job);
+    for (int i = 0; i < started; i++)
+        pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&job.lock);
+    free(threads);
+
+    //errors are only reported once every worker has stopped
+    if (job.failed != -1)
+        error_(1, "%s: [runFrames] Could not work on the image data of frame %d.", exeName, job.failed);
+}
+
+//Writes "stream" to "outputFile" as IDAT chunks, or as fdAT chunks numbered from "*sequence" if "fdAT" is set.
+static int writeFrameStream(FILE *outputFile, const byteBuffer *stream, int fdAT, uint32_t *sequence)
+{
+    unsigned char *chunkData = malloc(SEQUENCE_LENGTH + IDAT_CHUNK_SIZE);
+    int failed = 0;
+
+    for (size_t i = 0; i < stream->length && !failed; i += IDAT_CHUNK_SIZE)
+    {
+        size_t length = stream->length - i < IDAT_CHUNK_SIZE ? stream->length - i : IDAT_CHUNK_SIZE;
+
+        if (fdAT)
+        {
+            putUint32(chunkData, (*sequence)++);
+            memcpy(chunkData + SEQUENCE_LENGTH, stream->data + i, length);
+            failed = chunkWrite(outputFile, "fdAT", chunkData, SEQUENCE_LENGTH + length);
+        }
+        else
+            failed = chunkWrite(outputFile, "IDAT", stream->data + i, length);
+    }
+
+    free(chunkData);
+    return failed;
+}
+
+//Writes "image" to "outputFile", replacing the data chunks of each embedded frame and renumbering the fcTL and fdAT sequence.
+//Every other chunk is copied verbatim. Returns 0 on success.
+static int apngWrite(const apngImage *image, FILE *outputFile)
+{
+    pngChunk chunk;
+    size_t offset = 0;
+    uint32_t sequence = 0;                      //next fcTL/fdAT sequence number
+    int current = -1,                           //index of the frame whose data chunks are being read
+        newFrame = 1,                           //1 if the next IDAT or fdAT chunk starts a new frame
+        failed = fwrite(image->file.data, 1, 8, outputFile) != 8;
+
+    while (!failed && chunkNext(&image->file, &offset, &chunk))
+    {
+        if (strcmp(chunk.type, "fcTL") == 0 && chunk.length == FCTL_LENGTH)
+        {
+            unsigned char control[FCTL_LENGTH];
+
+            memcpy(control, chunk.data, FCTL_LENGTH);
+            putUint32(control, sequence++);
+            failed = chunkWrite(outputFile, "fcTL", control, FCTL_LENGTH);
+            newFrame = 1;
+        }
+        else if (strcmp(chunk.type, "IDAT") == 0 || (strcmp(chunk.type, "fdAT") == 0 && chunk.length >= SEQUENCE_LENGTH))
+        {
+            //write the whole frame at its first data chunk, and drop the chunks that continued it
+            if (newFrame)
+            {
+                const apngFrame *frame = &image->frames[++current];
+
+                failed = writeFrameStream(outputFile, frame->dataLength ? &frame->output : &frame->stream, chunk.type[0] == 'f', &sequence);
+                newFrame = 0;
+            }
+        }
+        else
+        {
+            failed = fwrite(image->file.data + chunk.offset, 1, chunk.total, outputFile) != chunk.total;
+            if (strcmp(chunk.type, "IEND") == 0)
+                break;
+        }
+    }
+
+    return failed;
+}
+
+//Frees the memory held by "image" and unmaps its file.
+static void apngFree(apngImage *image)
+{
+    for (int i = 0; i < image->count; i++)
+    {
+        bufferFree(&image->frames[i].stream);
+        bufferFree(&image->frames[i].output);
+    }
+    free(image->frames);
+    chunkClose(&image->file);
+}
+
+void apngEncode(const char *carrierPath, const char *payloadPath, char *outputPath)
+{
+    apngImage carrier;                          //frames of the file at location carrierPath
+    FILE *payloadFile, *outputFile;
+    unsigned char *payload,                     //contents of the file at location payloadPath
+                  *header;                      //marker, payload size and frame table, followed by the first frame's share of payload
+    unsigned long payloadsize = 0;              //size of file "payload" in bytes
+    size_t headerLength, remaining, used = 0;
+
+
+
+    //frames are decoded and recompressed whole, so neither the carrier cache nor restart points are used
+    if (cacheDir || restartInterval)
+        error_(0, "%s: [apngEncode] -C and -r do not apply to animated carriers and will be ignored.", exeName);
+
+    apngRead(carrierPath, &carrier);
+
+    //if the initialization of payload fails, exit the program
+    if ( !(payloadFile = fopen(payloadPath, "rb")) )
+        error_(1, "%s: [apngEncode] Could not read in payload.", exeName);
+    payloadsize = fsize(payloadPath);
+    payload = malloc(payloadsize + 1);
+    if (fread(payload, 1, payloadsize, payloadFile) != payloadsize)
+        error_(1, "%s: [apngEncode] Could not read in payload.", exeName);
+    fclose(payloadFile);
+
+    //lay the payload out across the frames in order, filling each one before moving on to the next
+    headerLength = FRAME_HEADER_LENGTH + carrier.count * FRAME_ENTRY_LENGTH;
+    if (frameCapacity(&carrier, &carrier.frames[0]) < headerLength)
+        error_(1, "%s: [apngEncode] First frame is too small to hold the frame table.", exeName);
+    remaining = payloadsize;
+    for (int i = 0; i < carrier.count; i++)
+    {
+        size_t capacity = frameCapacity(&carrier, &carrier.frames[i]) - (i ? 0 : headerLength);
+
+        carrier.frames[i].data = payload + used;
+        carrier.frames[i].dataLength = remaining < capacity ? remaining : capacity;
+        used += carrier.frames[i].dataLength;
+        remaining -= carrier.frames[i].dataLength;
+    }
+    if (remaining)
+        error_(1, "%s: [apngEncode] Payload will not fit in carrier.", exeName);
+
+    //the first frame carries the marker, payloadsize, frame count and each frame's share of the payload ahead of its own share
+    header = malloc(headerLength + carrier.frames[0].dataLength);
+    putFrameWord(header, MARKER);
+    putFrameWord(header + 4, payloadsize);
+    putFrameWord(header + 8, carrier.count);
+    for (int i = 0; i < carrier.count; i++)
+        putFrameWord(header + FRAME_HEADER_LENGTH + i * FRAME_ENTRY_LENGTH, carrier.frames[i].dataLength);
+    memcpy(header + headerLength, payload, carrier.frames[0].dataLength);
+    carrier.frames[0].data = header;
+    carrier.frames[0].dataLength += headerLength;
+
+    //decode, embed into and recompress every frame holding part of the payload in parallel
+    runFrames(&carrier, 1);
+
+    //exit the program if a file already exists at location outputPath, or if a file cannot be created at outputPath
+    if (favailable(outputPath))
+    {
+        if ( !(outputFile = fopen(outputPath, "wb")) )
+            error_(1, "%s: [apngEncode] Could not create '%s' file.", exeName, outputPath);
+    }
+    else
+        error_(1, "%s: [apngEncode] file '%s' already exists.", exeName, outputPath);
+
+    if (apngWrite(&carrier, outputFile) != 0)
+    {
+        fremove(outputFile, outputPath);
+        error_(1, "%s: [apngEncode] Could not write '%s' file.", exeName, outputPath);
+    }
+    fclose(outputFile);
+
+    free(header);
+    free(payload);
+    apngFree(&carrier);
+
+    return;
+}
+
+void apngDecode(const char *packagePath, char *outputPath)
+{
+    apngImage package;                          //frames of the file at location packagePath
+    FILE *outputFile;
+    unsigned char *payload,                     //payload reassembled from every frame
+                  *header;                      //marker, payload size, frame count and frame table
+    unsigned long payloadsize = 0;
+    size_t headerLength, used = 0;
+    apngFrame *first;
+
+
+
+    apngRead(packagePath, &package);
+    first = &package.frames[0];
+
+    //the first frame must be decoded on its own, since it holds the table saying where the rest of the payload lies
+    headerLength = FRAME_HEADER_LENGTH + package.count * FRAME_ENTRY_LENGTH;
+    if (frameCapacity(&package, first) < headerLength)
+        error_(1, "%s: [apngDecode] file '%s' does not contain a file embedded by this program.", exeName, packagePath);
+    decodeFrame(&package, first);
+    header = malloc(headerLength);
+    extractBytes(first->pixels, header, headerLength);
+
+    if (getFrameWord(header) != MARKER || getFrameWord(header + 8) != (uint32_t)package.count)
+        error_(1, "%s: [apngDecode] file '%s' does not contain a file embedded by this program.", exeName, packagePath);
+    payloadsize = getFrameWord(header + 4);
+    payload = malloc(payloadsize + 1);
+
+    for (int i = 0; i < package.count; i++)
+    {
+        apngFrame *frame = &package.frames[i];
+
+        frame->data = payload + used;
+        frame->dataLength = getFrameWord(header + FRAME_HEADER_LENGTH + i * FRAME_ENTRY_LENGTH);
+        if (frame->dataLength > frameCapacity(&package, frame) - (i ? 0 : headerLength) || frame->dataLength > payloadsize - used)
+            error_(1, "%s: [apngDecode] Frame table of '%s' is corrupt.", exeName, packagePath);
+        used += frame->dataLength;
+    }
+    if (used != payloadsize)
+        error_(1, "%s: [apngDecode] Frame table of '%s' is corrupt.", exeName, packagePath);
+
+    //extract the first frame's share from the rows already decoded, then the remaining frames in parallel
+    extractBytes(first->pixels + headerLength * BYTE_SIZE, first->data, first->dataLength);
+    free(first->pixels);
+    first->pixels = NULL;
+    first->dataLength = 0;
+    runFrames(&package, 0);
+
+    //exit the program if a file already exists at location outputPath, or if a file cannot be created at outputPath
+    if (favailable(outputPath))
+    {
+        if ( !(outputFile = fopen(outputPath, "wb")) )
+            error_(1, "%s: [apngDecode] Could not create '%s' file.", exeName, outputPath);
+    }
+    else
+        error_(1, "%s: [apngDecode] file '%s' already exists.", exeName, outputPath);
+
+    if (fwrite(payload, 1, payloadsize, outputFile) != payloadsize)
+    {
+        fremove(outputFile, outputPath);
+        error_(1, "%s: [apngDecode] Could not write '%s' file.", exeName, outputPath);
+    }
+    fclose(outputFile);
+
+    free(header);
+    free(payload);
+    apngFree(&package);
+
+    return;
+}
@@ -0,0 +1,10 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+int isAPNG(const char *path);
+void apngEncode(const char *carrierPath, const char *payloadPath, char *outputPath);
+void apngDecode(const char *packagePath, char *outputPath);
@@ -0,0 +1,319 @@
+#define _GNU_SOURCE                             //for copy_file_range
+#include "carrier.h"
+#include "globalvars.h"
+#include "errorHandling.h"
+#include "fileHandling.h"
+#include "encoding.h"
+#include "pngChunks.h"
+
+#define MAGIC_LENGTH 8                          //number of bytes read to identify a carrier's format
+#define BMP_FILE_HEADER_LENGTH 14               //length of the BITMAPFILEHEADER, in bytes
+#define BMP_INFO_HEADER_LENGTH 40               //smallest supported BITMAPINFOHEADER, in bytes
+#define BMP_BI_RGB 0                            //uncompressed BMP pixel data
+#define BMP_BI_BITFIELDS 3                      //uncompressed BMP pixel data with channel masks
+#define NETPBM_MAXVAL 255                       //largest sample value that still fits in one byte
+#define COPY_BUFFER_SIZE 1048576                //size of the buffer used when copy_file_range is unavailable, in bytes
+
+
+//Returns the format of the file at "path", judged by its magic number alone.
+carrierFormat carrierDetect(const char *path)
+{
+    FILE *file;
+    unsigned char magic[MAGIC_LENGTH] = { 0 };
+
+    if ( !(file = fopen(path, "rb")) )
+        return CARRIER_UNKNOWN;
+    fread(magic, 1, MAGIC_LENGTH, file);
+    fclose(file);
+
+    if (memcmp(magic, pngSignature, PNG_SIG_LENGTH) == 0)
+        return CARRIER_PNG;
+    if (magic[0] == 'P' && magic[1] == '6' && isspace(magic[2]))
+        return CARRIER_PPM;
+    if (magic[0] == 'P' && magic[1] == '7' && magic[2] == '\n')
+        return CARRIER_PAM;
+    if (magic[0] == 'B' && magic[1] == 'M')
+        return CARRIER_BMP;
+    return CARRIER_UNKNOWN;
+}
+
+//Returns the little-endian integer of "length" bytes stored at "bytes".
+static uint32_t readLittle(const unsigned char *bytes, int length)
+{
+    uint32_t val = 0;
+
+    while (length--)
+        val = (val << 8) | bytes[length];
+    return val;
+}
+
+//Reads the next decimal number of a netpbm header at "*pos", skipping whitespace and comments. Returns -1 if there is none.
+static long netpbmNumber(const unsigned char *data, size_t size, size_t *pos)
+{
+    long val = 0;
+
+    while (*pos < size && (isspace(data[*pos]) || data[*pos] == '#'))
+    {
+        if (data[*pos] == '#')
+            while (*pos < size && data[*pos] != '\n')
+                (*pos)++;
+        else
+            (*pos)++;
+    }
+
+    if (*pos >= size || !isdigit(data[*pos]))
+        return -1;
+    while (*pos < size && isdigit(data[*pos]) && val < INT32_MAX / 10)
+        val = val * 10 + (data[(*pos)++] - '0');
+    return val;
+}
+
+//Parses a binary PPM header. Returns the offset of the pixel data, or 0 if the header is invalid or unsupported.
+static size_t parsePPM(rawCarrier *carrier)
+{
+    size_t pos = 2;
+    long maxval;
+
+    carrier->width = netpbmNumber(carrier->map, carrier->size, &pos);
+    carrier->height = netpbmNumber(carrier->map, carrier->size, &pos);
+    maxval = netpbmNumber(carrier->map, carrier->size, &pos);
+    carrier->channels = 3;
+
+    //exactly one whitespace character separates the header from the pixel data
+    if (maxval <= 0 || maxval > NETPBM_MAXVAL || pos >= carrier->size || !isspace(carrier->map[pos]))
+        return 0;
+    return pos + 1;
+}
+
+//Parses a PAM header. Returns the offset of the pixel data, or 0 if the header is invalid or unsupported.
+static size_t parsePAM(rawCarrier *carrier)
+{
+    size_t pos = 3;
+    long maxval = 0;
+
+    carrier->width = carrier->height = carrier->channels = 0;
+    while (pos < carrier->size)
+    {
+        char line[64] = { 0 }, keyword[16] = { 0 };
+        long val = 0;
+        size_t end = pos;
+
+        while (end < carrier->size && carrier->map[end] != '\n')
+            end++;
+        memcpy(line, carrier->map + pos, end - pos < sizeof(line) - 1 ? end - pos : sizeof(line) - 1);
+        pos = end + 1;
+
+        if (line[0] == '#' || sscanf(line, "%15s %ld", keyword, &val) < 1)
+            continue;
+        if (strcmp(keyword, "ENDHDR") == 0)
+            return maxval > 0 && maxval <= NETPBM_MAXVAL && pos <= carrier->size ? pos : 0;
+        if (strcmp(keyword, "WIDTH") == 0)
+            carrier->width = val;
+        else if (strcmp(keyword, "HEIGHT") == 0)
+            carrier->height = val;
+        else if (strcmp(keyword, "DEPTH") == 0)
+            carrier->channels = val;
+        else if (strcmp(keyword, "MAXVAL") == 0)
+            maxval = val;
+    }
+
+    return 0;
+}
+
+//Parses the headers of an uncompressed BMP and points carrier->row_pointers at its rows, which are usually stored bottom-up and padded.
+//Returns 0 if the headers are invalid or unsupported, or 1 on success.
+static int parseBMP(rawCarrier *carrier)
+{
+    const unsigned char *header = carrier->map;
+    size_t offset, stride;
+    int32_t height;
+    int bitCount, compression;
+
+
+
+    if (carrier->size < BMP_FILE_HEADER_LENGTH + BMP_INFO_HEADER_LENGTH || readLittle(header + 14, 4) < BMP_INFO_HEADER_LENGTH)
+        return 0;
+
+    offset = readLittle(header + 10, 4);
+    carrier->width = (int32_t)readLittle(header + 18, 4);
+    height = (int32_t)readLittle(header + 22, 4);
+    bitCount = readLittle(header + 28, 2);
+    compression = readLittle(header + 30, 4);
+
+    //only uncompressed 24- and 32-bit pixel data maps one byte per channel
+    if (!(bitCount == 24 && compression == BMP_BI_RGB) && !(bitCount == 32 && (compression == BMP_BI_RGB || compression == BMP_BI_BITFIELDS)))
+        return 0;
+
+    carrier->height = height < 0 ? -height : height;
+    carrier->channels = bitCount / BYTE_SIZE;
+    stride = (((size_t)carrier->width * bitCount + 31) / 32) * 4;
+    if (carrier->width <= 0 || carrier->height <= 0 || offset > carrier->size || (carrier->size - offset) / stride < (size_t)carrier->height)
+        return 0;
+
+    //a positive height means the last row of the image is stored first
+    carrier->row_pointers = malloc(carrier->height * sizeof(unsigned char *));
+    for (int y = 0; y < carrier->height; y++)
+        carrier->row_pointers[y] = carrier->map + offset + (height > 0 ? carrier->height - 1 - y : y) * stride;
+    return 1;
+}
+
+//Maps the PPM, PAM or BMP file at "path" into "carrier" and points its rows at the pixel data in the mapping.
+//If "writable" is set the mapping is shared, so embedding into the rows modifies the file itself.
+static void rawOpen(const char *path, int writable, rawCarrier *carrier)
+{
+    int fd;
+    struct stat st;
+    size_t offset = 0;
+
+
+
+    memset(carrier, 0, sizeof(*carrier));
+    carrier->format = carrierDetect(path);
+
+    if ((fd = open(path, writable ? O_RDWR : O_RDONLY)) == -1 || fstat(fd, &st) != 0 || st.st_size == 0)
+        error_(1, "%s: [rawOpen] Cannot open '%s'.", exeName, path);
+    carrier->size = st.st_size;
+    carrier->map = mmap(NULL, carrier->size, PROT_READ | (writable ? PROT_WRITE : 0), writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (carrier->map == MAP_FAILED)
+        error_(1, "%s: [rawOpen] Cannot map '%s': %s", exeName, path, strerror(errno));
+
+    //netpbm rows are stored top-down and unpadded right after the header
+    if (carrier->format == CARRIER_PPM || carrier->format == CARRIER_PAM)
+    {
+        offset = carrier->format == CARRIER_PPM ? parsePPM(carrier) : parsePAM(carrier);
+        if (!offset || carrier->width <= 0 || carrier->height <= 0 || carrier->channels <= 0
+            || (carrier->size - offset) / ((size_t)carrier->width * carrier->channels) < (size_t)carrier->height)
+            error_(1, "%s: [rawOpen] '%s' is not an 8-bit binary PPM/PAM file.", exeName, path);
+
+        carrier->row_pointers = malloc(carrier->height * sizeof(unsigned char *));
+        for (int y = 0; y < carrier->height; y++)
+            carrier->row_pointers[y] = carrier->map + offset + (size_t)y * carrier->width * carrier->channels;
+    }
+    else if (carrier->format == CARRIER_BMP)
+    {
+        if (!parseBMP(carrier))
+            error_(1, "%s: [rawOpen] '%s' is not an uncompressed 24- or 32-bit BMP file.", exeName, path);
+    }
+    else
+        error_(1, "%s: [rawOpen] '%s' is not a PPM, PAM or BMP file.", exeName, path);
+}
+
+//Unmaps the file held by "carrier", writing back any changes made through a writable mapping.
+static void rawClose(rawCarrier *carrier)
+{
+    munmap(carrier->map, carrier->size);
+    free(carrier->row_pointers);
+    memset(carrier, 0, sizeof(*carrier));
+}
+
+//Copies the file at "inputPath" to a new file at "outputPath", letting the kernel do the copy where it can. Returns 0 on success,
+//-1 if the copy failed after "outputPath" was created, or -2 if "outputPath" was never created (so it may belong to someone else).
+static int copyCarrier(const char *inputPath, const char *outputPath)
+{
+    int input, output;
+    struct stat st;
+    off_t copied = 0;
+    ssize_t result = 0;
+
+
+
+    if ((input = open(inputPath, O_RDONLY)) == -1)
+        return -2;
+    if (fstat(input, &st) != 0 || (output = open(outputPath, O_WRONLY | O_CREAT | O_EXCL, st.st_mode & 0777)) == -1)
+    {
+        close(input);
+        return -2;
+    }
+
+    while (copied < st.st_size && (result = copy_file_range(input, NULL, output, NULL, st.st_size - copied, 0)) > 0)
+        copied += result;
+
+    //fall back to an ordinary copy of whatever is left if the kernel cannot copy between these files
+    if (copied < st.st_size)
+    {
+        char *buffer = malloc(COPY_BUFFER_SIZE);
+
+        while (copied < st.st_size && (result = read(input, buffer, COPY_BUFFER_SIZE)) > 0 && write(output, buffer, result) == result)
+            copied += result;
+        free(buffer);
+    }
+
+    close(input);
+    if ((close(output) != 0) | (copied != st.st_size))
+        return -1;
+    return 0;
+}
+
+void rawEncode(const char *carrierPath, const char *payloadPath, char *outputPath)
+{
+    rawCarrier carrier;                         //mapping and rows of the file at location carrierPath, then outputPath
+    FILE *payload;                              //pointer to the file at location payloadPath
+    unsigned long payloadsize = 0;              //size of file "payload" in bytes
+    int result;
+
+
+
+    if (containerMode || restartInterval || cacheDir)
+        error_(0, "%s: [rawEncode] -m, -r and -C only apply to PNG carriers and will be ignored.", exeName);
+
+    //if the initialization of payload fails, exit the program
+    if ( !(payload = fopen(payloadPath, "rb")) )
+        error_(1, "%s: [rawEncode] Could not read in payload.", exeName);
+    else
+        payloadsize = fsize(payloadPath);
+
+    //check the carrier and the payload's fit before creating anything, using the same rule as pngEncode
+    rawOpen(carrierPath, 0, &carrier);
+    if (((unsigned long)carrier.width * carrier.height * carrier.channels) < (payloadsize * 8 + MARKER_PLUS_FILESIZE))
+        error_(1, "%s: [rawEncode] Payload will not fit in carrier.", exeName);
+    rawClose(&carrier);
+
+    //exit the program if a file already exists at location outputPath, or if the carrier cannot be copied there
+    if (favailable(outputPath) && (result = copyCarrier(carrierPath, outputPath)) != 0)
+    {
+        //only remove a partial copy; if the file could not be created, whatever is at outputPath now is not ours
+        if (result == -1)
+            remove(outputPath);
+        error_(1, "%s: [rawEncode] Could not create '%s' file.", exeName, outputPath);
+    }
+
+    //embed straight into the copy's pixel data through a shared mapping; nothing is decoded or encoded
+    rawOpen(outputPath, 1, &carrier);
+    embedRows(carrier.row_pointers, carrier.height, carrier.width * carrier.channels, payload, payloadsize);
+    rawClose(&carrier);
+
+    fclose(payload);
+
+    return;
+}
+
+void rawDecode(const char *packagePath, char *outputPath)
+{
+    rawCarrier package;                         //mapping and rows of the file at location packagePath
+    FILE *outputFile;
+
+
+
+    rawOpen(packagePath, 0, &package);
+
+    //exit the program if a file already exists at location outputPath, or if a file cannot be created at outputPath
+    if (favailable(outputPath))
+    {
+        if ( !(outputFile = fopen(outputPath, "wb")) )
+            error_(1, "%s: [rawDecode] Could not create '%s' file.", exeName, outputPath);
+    }
+    else
+        error_(1, "%s: [rawDecode] file '%s' already exists.", exeName, outputPath);
+
+    if (extractRows(package.row_pointers, package.height, package.width * package.channels, outputFile) != 0)
+    {
+        fclose(outputFile);
+        error_(1, "%s: [rawDecode] file '%s' does not contain a file embedded by this program.", exeName, packagePath);
+    }
+
+    fclose(outputFile);
+    rawClose(&package);
+
+    return;
+}
@@ -0,0 +1,35 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+typedef enum carrierFormat
+{
+    CARRIER_UNKNOWN,                            //none of the magic numbers below
+    CARRIER_PNG,                                //PNG (or APNG), handled through libpng or at chunk level
+    CARRIER_PPM,                                //binary PPM ("P6")
+    CARRIER_PAM,                                //PAM ("P7")
+    CARRIER_BMP                                 //uncompressed 24- or 32-bit BMP ("BM")
+} carrierFormat;
+
+typedef struct rawCarrier
+{
+    unsigned char *map;                         //mapping of the whole file
+    size_t size;                                //size of the file, in bytes
+    unsigned char **row_pointers;               //array of pointers to the pixel data for each row, in top-to-bottom order
+
+    int width,                                  //width of the image in pixels
+        height,                                 //height of the image in pixels
+        channels;                               //number of bytes per pixel
+    carrierFormat format;                       //format the file was parsed as
+} rawCarrier;
+
+carrierFormat carrierDetect(const char *path);
+void rawEncode(const char *carrierPath, const char *payloadPath, char *outputPath);
+void rawDecode(const char *packagePath, char *outputPath);
@@ -0,0 +1,279 @@
+#include "carrierCache.h"
+#include "globalvars.h"
+#include "errorHandling.h"
+
+#define CACHE_MAGIC 0x73746343ul                //integer that will indicate a file is a carrier cache entry
+#define CACHE_EXT ".raw"                        //extension given to every cache entry
+#define CACHE_TEMP_EXT ".tmp"                   //extension given to an entry while it is being written, after the writer's process ID
+
+typedef struct cacheHeader
+{
+    uint32_t magic;                             //always CACHE_MAGIC
+    uint32_t height;                            //number of rows in the cached pixel data
+    uint64_t rowbytes;                          //length of each row, in bytes
+    uint64_t dev,                               //device of the carrier file the entry was decoded from
+             ino,                               //inode of the carrier file
+             size;                              //size of the carrier file, in bytes
+    int64_t mtime_sec,                          //modification time of the carrier file, seconds part
+            mtime_nsec;                         //modification time of the carrier file, nanoseconds part
+} cacheHeader;
+
+typedef struct cacheEntry
+{
+    char *path;                                 //path of the cache entry
+    off_t size;                                 //size of the cache entry, in bytes
+    struct timespec used;                       //last time the cache entry was used
+} cacheEntry;
+
+
+//Fills "header" with the identity of the file open at "carrierFd". Returns 0 on success.
+static int cacheKey(int carrierFd, int height, size_t rowbytes, cacheHeader *header)
+{
+    struct stat st;
+
+    if (fstat(carrierFd, &st) != 0)
+        return -1;
+
+    memset(header, 0, sizeof(*header));
+    header->magic = CACHE_MAGIC;
+    header->height = height;
+    header->rowbytes = rowbytes;
+    header->dev = st.st_dev;
+    header->ino = st.st_ino;
+    header->size = st.st_size;
+    header->mtime_sec = st.st_mtim.tv_sec;
+    header->mtime_nsec = st.st_mtim.tv_nsec;
+    return 0;
+}
+
+//Returns the path of the cache entry within "cacheDir" for the carrier identified by "header".
+static char *cachePath(const char *cacheDir, const cacheHeader *header)
+{
+    size_t length = strlen(cacheDir) + 96;
+    char *path = malloc(length);
+
+    snprintf(path, length, "%s/%llx-%llx-%llx-%llx.%llx" CACHE_EXT, cacheDir,
+        (unsigned long long)header->dev, (unsigned long long)header->ino, (unsigned long long)header->size,
+        (unsigned long long)header->mtime_sec, (unsigned long long)header->mtime_nsec);
+    return path;
+}
+
+//Points each of the "height" entries of view->rows at consecutive rows of "rowbytes" bytes, starting at "data".
+static void cacheRows(cacheView *view, unsigned char *data, int height, size_t rowbytes)
+{
+    view->rows = malloc(height * sizeof(png_bytep));
+    for (int y = 0; y < height; y++)
+        view->rows[y] = data + y * rowbytes;
+}
+
+//Maps the cached pixel data of the carrier open at "carrierFd" into "view" as a private copy-on-write mapping.
+//Returns 1 on a cache hit, or 0 if the carrier has not been cached (or the entry is stale).
+int cacheLoad(const char *cacheDir, int carrierFd, int height, size_t rowbytes, cacheView *view)
+{
+    cacheHeader key, header;
+    struct stat st;
+    char *path;
+    int fd;
+    size_t length = sizeof(cacheHeader) + (size_t)height * rowbytes;
+    void *base;
+
+
+
+    memset(view, 0, sizeof(*view));
+    if (cacheKey(carrierFd, height, rowbytes, &key) != 0)
+        return 0;
+
+    //a private mapping can be written to even through a read-only descriptor, so read-only caches work too
+    path = cachePath(cacheDir, &key);
+    if ((fd = open(path, O_RDONLY)) == -1)
+    {
+        free(path);
+        return 0;
+    }
+
+    //if the entry does not describe exactly this carrier, or is truncated (mapping it would fault past its end), treat it as a miss and remove it
+    if (read(fd, &header, sizeof(header)) != sizeof(header) || memcmp(&header, &key, sizeof(header)) != 0
+        || fstat(fd, &st) != 0 || (size_t)st.st_size != length)
+    {
+        close(fd);
+        unlink(path);
+        free(path);
+        return 0;
+    }
+    free(path);
+
+    //map the entry privately, so that embedding into the rows never writes back to the cache file
+    if ((base = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    {
+        error_(0, "%s: [cacheLoad] Cannot map cache entry: %s", exeName, strerror(errno));
+        close(fd);
+        return 0;
+    }
+
+    //mark the entry as most recently used; a cache we cannot write to simply keeps its old order
+    futimens(fd, NULL);
+    close(fd);
+
+    view->base = base;
+    view->length = length;
+    view->mapped = 1;
+    cacheRows(view, (unsigned char *)base + sizeof(cacheHeader), height, rowbytes);
+    return 1;
+}
+
+//Allocates room in "view" for "height" rows of "rowbytes" bytes each, to be decoded into and then stored.
+void cacheAlloc(int height, size_t rowbytes, cacheView *view)
+{
+    memset(view, 0, sizeof(*view));
+    view->length = (size_t)height * rowbytes;
+    if ( !(view->base = malloc(view->length)) )
+        error_(1, "%s: [cacheAlloc] Cannot allocate %zu bytes.", exeName, view->length);
+    cacheRows(view, view->base, height, rowbytes);
+}
+
+//Orders cache entries from least to most recently used.
+static int cacheCompare(const void *a, const void *b)
+{
+    const cacheEntry *x = a, *y = b;
+
+    if (x->used.tv_sec != y->used.tv_sec)
+        return x->used.tv_sec < y->used.tv_sec ? -1 : 1;
+    if (x->used.tv_nsec != y->used.tv_nsec)
+        return x->used.tv_nsec < y->used.tv_nsec ? -1 : 1;
+    return 0;
+}
+
+//Returns 1 if "name" ends with "extension".
+static int cacheHasExt(const char *name, const char *extension)
+{
+    size_t nameLength = strlen(name), extLength = strlen(extension);
+
+    return nameLength > extLength && strcmp(name + nameLength - extLength, extension) == 0;
+}
+
+//Returns 1 if "name" is a temporary entry whose writer is no longer running, e.g. because its job was killed before renaming it into place.
+static int cacheStale(const char *name)
+{
+    const char *end = name + strlen(name) - strlen(CACHE_TEMP_EXT),
+               *start = end;
+    long pid;
+
+    while (start > name && start[-1] != '.')
+        start--;
+    if (start == end || sscanf(start, "%ld", &pid) != 1 || pid <= 0)
+        return 1;
+    return kill((pid_t)pid, 0) != 0 && errno == ESRCH;
+}
+
+//Removes the least recently used entries from "cacheDir" until their combined size is within CACHE_SIZE_LIMIT.
+//Temporary entries count towards the limit as well, and those left behind by jobs that are no longer running are always removed.
+static void cacheEvict(const char *cacheDir)
+{
+    DIR *dir;
+    struct dirent *ent;
+    struct stat st;
+    cacheEntry *entries = NULL;
+    size_t count = 0, capacity = 0;
+    unsigned long long total = 0;
+
+
+
+    if ( !(dir = opendir(cacheDir)) )
+        return;
+
+    while ((ent = readdir(dir)))
+    {
+        size_t nameLength = strlen(ent->d_name);
+        int temporary = cacheHasExt(ent->d_name, CACHE_TEMP_EXT);
+        char *path;
+
+        if (!temporary && !cacheHasExt(ent->d_name, CACHE_EXT))
+            continue;
+
+        path = malloc(strlen(cacheDir) + nameLength + 2);
+        sprintf(path, "%s/%s", cacheDir, ent->d_name);
+        if ((temporary && cacheStale(ent->d_name) && remove(path) == 0) || stat(path, &st) != 0)
+        {
+            free(path);
+            continue;
+        }
+
+        if (count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 16;
+            entries = realloc(entries, capacity * sizeof(cacheEntry));
+        }
+        entries[count].path = path;
+        entries[count].size = st.st_size;
+        entries[count].used = st.st_mtim;
+        total += st.st_size;
+        count++;
+    }
+    closedir(dir);
+
+    qsort(entries, count, sizeof(cacheEntry), cacheCompare);
+    for (size_t i = 0; i < count; i++)
+    {
+        if (total > CACHE_SIZE_LIMIT && remove(entries[i].path) == 0)
+            total -= entries[i].size;
+        free(entries[i].path);
+    }
+    free(entries);
+}
+
+//Stores the freshly decoded pixel data in "view" as the cache entry for the carrier open at "carrierFd".
+//Failures are reported but not fatal, since the cache is only an optimization.
+void cacheStore(const char *cacheDir, int carrierFd, const cacheView *view, int height, size_t rowbytes)
+{
+    cacheHeader header;
+    char *path, *tempPath;
+    FILE *cacheFile;
+
+
+
+    //entries that could never fit within the size limit are not worth writing
+    if (sizeof(cacheHeader) + view->length > CACHE_SIZE_LIMIT || cacheKey(carrierFd, height, rowbytes, &header) != 0)
+        return;
+
+    if (mkdir(cacheDir, 0700) != 0 && errno != EEXIST)
+    {
+        error_(0, "%s: [cacheStore] Cannot create cache directory '%s': %s", exeName, cacheDir, strerror(errno));
+        return;
+    }
+
+    //write the entry under a temporary name and rename it into place, so that concurrent jobs never map a partial entry
+    path = cachePath(cacheDir, &header);
+    tempPath = malloc(strlen(path) + 32);
+    sprintf(tempPath, "%s.%ld" CACHE_TEMP_EXT, path, (long)getpid());
+
+    if ( !(cacheFile = fopen(tempPath, "wb")) )
+        error_(0, "%s: [cacheStore] Cannot create '%s': %s", exeName, tempPath, strerror(errno));
+    else
+    {
+        int failed = fwrite(&header, sizeof(header), 1, cacheFile) != 1 || fwrite(view->base, 1, view->length, cacheFile) != view->length;
+
+        if ((fclose(cacheFile) != 0) | failed || rename(tempPath, path) != 0)
+        {
+            error_(0, "%s: [cacheStore] Cannot write '%s': %s", exeName, path, strerror(errno));
+            remove(tempPath);
+        }
+    }
+
+    free(tempPath);
+    free(path);
+    cacheEvict(cacheDir);
+}
+
+//Unmaps or frees the pixel data held by "view".
+void cacheRelease(cacheView *view)
+{
+    if (view->base)
+    {
+        if (view->mapped)
+            munmap(view->base, view->length);
+        else
+            free(view->base);
+    }
+    free(view->rows);
+    memset(view, 0, sizeof(*view));
+}
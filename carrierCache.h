@@ -0,0 +1,29 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <png.h>
+
+#ifndef CACHE_SIZE_LIMIT
+#define CACHE_SIZE_LIMIT 536870912ull           //combined size of all cache files, in bytes, above which the least recently used are evicted
+#endif
+
+typedef struct cacheView
+{
+    void *base;                                 //start of the mapping (or allocation) holding the decoded pixel data
+    size_t length;                              //length of base, in bytes
+    int mapped;                                 //1 if base is a MAP_PRIVATE mapping of a cache file, 0 if it was allocated with malloc
+    png_bytep *rows;                            //array of pointers to the pixel data for each row within base
+} cacheView;
+
+int cacheLoad(const char *cacheDir, int carrierFd, int height, size_t rowbytes, cacheView *view);
+void cacheAlloc(int height, size_t rowbytes, cacheView *view);
+void cacheStore(const char *cacheDir, int carrierFd, const cacheView *view, int height, size_t rowbytes);
+void cacheRelease(cacheView *view);
@@ -0,0 +1,161 @@
+#include "container.h"
+#include "globalvars.h"
+#include "errorHandling.h"
+#include "fileHandling.h"
+#include "encoding.h"
+#include "pngChunks.h"
+#include <zlib.h>
+
+#define CONTAINER_HEADER_LENGTH 8               //length of the marker and payload size held by the first container chunk, in bytes
+#define CONTAINER_CHUNK_SIZE 16777216           //largest amount of payload written to a single container chunk, in bytes
+
+
+//Stores the payload at "payloadPath" in container chunks inserted before the IEND chunk of the carrier at "carrierPath".
+//Every other chunk, IDAT included, is copied verbatim, so no image data is ever decoded.
+void containerEncode(const char *carrierPath, const char *payloadPath, char *outputPath)
+{
+    chunkFile carrier;                          //mapping of the file at location carrierPath
+    pngChunk chunk;                             //chunk currently being read from carrier
+    FILE *outputFile;
+    int payloadFd, failed = 0, haveEnd = 0;
+    struct stat st;
+    unsigned char *payload = NULL;              //mapping of the file at location payloadPath
+    unsigned char header[CONTAINER_HEADER_LENGTH];
+    size_t offset = 0,                          //offset of the next chunk to read from carrier
+           runStart = 0,                        //offset of the first carrier byte not yet written
+           payloadsize = 0;                     //size of file "payload" in bytes
+
+
+
+    //the pixel data is never decoded or recompressed, so neither the carrier cache nor restart points are used
+    if (cacheDir || restartInterval)
+        error_(0, "%s: [containerEncode] -C and -r do not apply in container mode (-m) and will be ignored.", exeName);
+
+    if (chunkOpen(carrierPath, &carrier) != 0)
+        error_(1, "%s: [containerEncode] '%s' is not a PNG file.", exeName, carrierPath);
+
+    //if the payload cannot be opened or mapped, exit the program
+    if ((payloadFd = open(payloadPath, O_RDONLY)) == -1 || fstat(payloadFd, &st) != 0)
+        error_(1, "%s: [containerEncode] Could not read in payload.", exeName);
+    payloadsize = st.st_size;
+    if (payloadsize > UINT32_MAX)
+        error_(1, "%s: [containerEncode] Payload is larger than 4 GiB.", exeName);
+    if (payloadsize && (payload = mmap(NULL, payloadsize, PROT_READ, MAP_PRIVATE, payloadFd, 0)) == MAP_FAILED)
+        error_(1, "%s: [containerEncode] Could not read in payload.", exeName);
+    close(payloadFd);
+
+    //exit the program if a file already exists at location outputPath, or if a file cannot be created at outputPath
+    if (favailable(outputPath))
+    {
+        if ( !(outputFile = fopen(outputPath, "wb")) )
+            error_(1, "%s: [containerEncode] Could not create '%s' file.", exeName, outputPath);
+    }
+    else
+        error_(1, "%s: [containerEncode] file '%s' already exists.", exeName, outputPath);
+
+    //write the carrier up to IEND in as few runs as possible, leaving out container chunks from any earlier encode
+    while (!failed && !haveEnd && chunkNext(&carrier, &offset, &chunk))
+    {
+        haveEnd = (strcmp(chunk.type, "IEND") == 0);
+        if (haveEnd || strcmp(chunk.type, CONTAINER_CHUNK) == 0)
+        {
+            failed = fwrite(carrier.data + runStart, 1, chunk.offset - runStart, outputFile) != chunk.offset - runStart;
+            runStart = offset;
+        }
+    }
+    if (!haveEnd)
+    {
+        fremove(outputFile, outputPath);
+        error_(1, "%s: [containerEncode] '%s' has no IEND chunk.", exeName, carrierPath);
+    }
+
+    //the first container chunk holds MARKER and the payload size; the payload follows in as many chunks as it needs
+    putUint32(header, MARKER);
+    putUint32(header + 4, payloadsize);
+    failed = failed || chunkWrite(outputFile, CONTAINER_CHUNK, header, CONTAINER_HEADER_LENGTH);
+    for (size_t i = 0; i < payloadsize && !failed; i += CONTAINER_CHUNK_SIZE)
+        failed = chunkWrite(outputFile, CONTAINER_CHUNK, payload + i, payloadsize - i < CONTAINER_CHUNK_SIZE ? payloadsize - i : CONTAINER_CHUNK_SIZE);
+    failed = failed || fwrite(carrier.data + chunk.offset, 1, chunk.total, outputFile) != chunk.total;
+
+    if (failed)
+    {
+        fremove(outputFile, outputPath);
+        error_(1, "%s: [containerEncode] Could not write '%s' file.", exeName, outputPath);
+    }
+    fclose(outputFile);
+
+    if (payload)
+        munmap(payload, payloadsize);
+    chunkClose(&carrier);
+
+    return;
+}
+
+//Extracts the payload stored in the container chunks of the package at "packagePath" to "outputPath".
+//Returns 0 without creating anything if the package has no container chunks.
+int containerDecode(const char *packagePath, char *outputPath)
+{
+    chunkFile package;                          //mapping of the file at location packagePath
+    pngChunk chunk;                             //chunk currently being read from package
+    FILE *outputFile = NULL;
+    size_t offset = 0;
+    unsigned long payloadsize = 0,              //payload size recorded in the first container chunk
+                  written = 0;                  //number of payload bytes written so far
+
+
+
+    if (chunkOpen(packagePath, &package) != 0)
+        return 0;
+
+    while (chunkNext(&package, &offset, &chunk) && strcmp(chunk.type, "IEND") != 0)
+    {
+        if (strcmp(chunk.type, CONTAINER_CHUNK) != 0)
+            continue;
+
+        //a damaged chunk would silently corrupt the payload, so verify each CRC
+        if (crc32(crc32(0L, chunk.data - 4, 4), chunk.data, chunk.length) != getUint32(chunk.data + chunk.length))
+        {
+            if (outputFile)
+                fremove(outputFile, outputPath);
+            error_(1, "%s: [containerDecode] Container chunk of '%s' is damaged.", exeName, packagePath);
+        }
+
+        //the first container chunk must hold the marker and payload size
+        if (!outputFile)
+        {
+            if (chunk.length != CONTAINER_HEADER_LENGTH || getUint32(chunk.data) != MARKER)
+                error_(1, "%s: [containerDecode] file '%s' does not contain a file embedded by this program.", exeName, packagePath);
+            payloadsize = getUint32(chunk.data + 4);
+
+            //exit the program if a file already exists at location outputPath, or if a file cannot be created at outputPath
+            if (favailable(outputPath))
+            {
+                if ( !(outputFile = fopen(outputPath, "wb")) )
+                    error_(1, "%s: [containerDecode] Could not create '%s' file.", exeName, outputPath);
+            }
+            else
+                error_(1, "%s: [containerDecode] file '%s' already exists.", exeName, outputPath);
+            continue;
+        }
+
+        if (written + chunk.length > payloadsize || fwrite(chunk.data, 1, chunk.length, outputFile) != chunk.length)
+        {
+            fremove(outputFile, outputPath);
+            error_(1, "%s: [containerDecode] Could not extract the payload of '%s'.", exeName, packagePath);
+        }
+        written += chunk.length;
+    }
+
+    chunkClose(&package);
+    if (!outputFile)
+        return 0;
+
+    if (written != payloadsize)
+    {
+        fremove(outputFile, outputPath);
+        error_(1, "%s: [containerDecode] Payload of '%s' is truncated.", exeName, packagePath);
+    }
+    fclose(outputFile);
+
+    return 1;
+}
@@ -0,0 +1,13 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CONTAINER_CHUNK "stPd"                  //private, safe-to-copy chunk holding the container header or part of the payload
+
+void containerEncode(const char *carrierPath, const char *payloadPath, char *outputPath);
+int containerDecode(const char *packagePath, char *outputPath);
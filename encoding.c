@@ -1,4 +1,5 @@
 #include "encoding.h"
+#include "globalvars.h"
 
 int ipow(int base, int exp)
 {
@@ -21,4 +22,190 @@ void writebit(unsigned long bitholder, unsigned char *byte, int bitposition)
         *byte |= 1;
     else
         *byte &= 0xFE;
+}
+
+//Writes MARKER, "payloadsize" and then the contents of "payload" to the least significant bits of "height" rows of "rowlength" bytes each.
+//The rows are treated as one continuous run of bytes, so the marker, size and payload bytes carry on across row boundaries.
+//Returns the number of payload bytes that were embedded.
+unsigned long embedRows(unsigned char **rows, int height, int rowlength, FILE *payload, unsigned long payloadsize)
+{
+    FILE *herp, *derp;
+    unsigned long embedded = 0;                 //number of payload bytes read in so far
+    unsigned long long bit = 0;                 //position of the current bit within the marker, payloadsize and payload, in that order
+    unsigned char bytebuffer = 0;               //buffer to hold the payload byte currently being written
+
+
+
+    if (loggingEnabled)
+    {
+        herp = fopen("herpcarrier.log", "w");
+        derp = fopen("derpcarrier.log", "w");
+    }
+
+    //iterate through each byte of the carrier image pixel data, row by row
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < rowlength; x++, bit++)
+        {
+            unsigned char *byte = rows[y] + x;
+
+            //once the marker and payloadsize are written, read in another payload byte every 8 carrier bytes; stop when the payload is exhausted
+            if (bit >= MARKER_PLUS_FILESIZE && (bit - MARKER_PLUS_FILESIZE) % BYTE_SIZE == 0)
+            {
+                if (embedded == payloadsize || !fread(&bytebuffer, 1, 1, payload))
+                    goto LOOP_END;
+                embedded++;
+            }
+
+            if (loggingEnabled)
+                fwrite(byte, 1, 1, herp);
+
+            //write the appropriate bit of the marker, payloadsize or bytebuffer to the least significant position of the current carrier byte
+            if (bit < MARKER_LENGTH)
+                writebit(MARKER, byte, bit);
+            else if (bit < MARKER_PLUS_FILESIZE)
+                writebit(payloadsize, byte, bit - MARKER_LENGTH);
+            else
+                writebit((unsigned long)bytebuffer, byte, (bit - MARKER_PLUS_FILESIZE) % BYTE_SIZE);
+
+            if (loggingEnabled)
+                fwrite(byte, 1, 1, derp);
+        }
+
+    LOOP_END:
+    if (loggingEnabled)
+    {
+        fclose(herp);
+        fclose(derp);
+    }
+
+    return embedded;
+}
+
+//Reads MARKER and the payload size from the least significant bits of "height" rows of "rowlength" bytes each, as written by embedRows,
+//then writes the payload that follows to "outputFile". Returns 0 on success, or -1 if the rows do not start with MARKER.
+int extractRows(unsigned char **rows, int height, int rowlength, FILE *outputFile)
+{
+    FILE *herpderp;
+    unsigned long markervalue = 0,
+                  payloadsize = 0,
+                  written = 0;                  //number of payload bytes written to outputFile so far
+    unsigned long long bit = 0;                 //position of the current bit within the marker, payloadsize and payload, in that order
+    unsigned char bytebuffer = 0;
+    int result = -1;
+
+
+
+    if (loggingEnabled)
+        herpderp = fopen("herpderpcarrier.log", "w");
+
+    //iterate through each byte of the package pixel data, row by row
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < rowlength; x++, bit++)
+        {
+            unsigned long lsb = rows[y][x] & 1;
+
+            if (loggingEnabled)
+                fwrite(rows[y] + x, 1, 1, herpderp);
+
+            if (bit < MARKER_LENGTH)
+            {
+                //if the completed markervalue is not equal to MARKER, then a package file embedded by this program was not found; stop reading
+                markervalue |= lsb << bit;
+                if (bit == MARKER_LENGTH - 1 && markervalue != MARKER)
+                    goto LOOP_END;
+                continue;
+            }
+            result = 0;
+
+            if (bit < MARKER_PLUS_FILESIZE)
+            {
+                payloadsize |= lsb << (bit - MARKER_LENGTH);
+                continue;
+            }
+
+            //if all bytes of the payload have been written, exit the loop
+            if (written == payloadsize)
+                goto LOOP_END;
+
+            //use the LSB of the current package byte to set the appropriate bit position in bytebuffer; once all 8 bits are set, write the byte to outputFile
+            bytebuffer |= lsb << (bit - MARKER_PLUS_FILESIZE) % BYTE_SIZE;
+            if ((bit - MARKER_PLUS_FILESIZE) % BYTE_SIZE == BYTE_SIZE - 1)
+            {
+                fwrite(&bytebuffer, 1, 1, outputFile);
+                bytebuffer = 0;
+                written++;
+            }
+        }
+
+    LOOP_END:
+    if (loggingEnabled)
+        fclose(herpderp);
+
+    return result;
+}
+
+//Reads MARKER and the payload size from the least significant bits of "height" rows of "rowlength" bytes each, as written by embedRows.
+//Returns 0 and stores the size in "payloadsize" if the rows start with MARKER, or -1 otherwise.
+int extractHeader(unsigned char **rows, int height, int rowlength, unsigned long *payloadsize)
+{
+    unsigned long markervalue = 0;
+
+    *payloadsize = 0;
+    for (unsigned long long bit = 0; bit < MARKER_PLUS_FILESIZE; bit++)
+    {
+        unsigned long lsb;
+
+        if (bit / rowlength >= (unsigned long long)height)
+            return -1;
+        lsb = rows[bit / rowlength][bit % rowlength] & 1;
+
+        if (bit < MARKER_LENGTH)
+            markervalue |= lsb << bit;
+        else
+            *payloadsize |= lsb << (bit - MARKER_LENGTH);
+    }
+
+    return markervalue == MARKER ? 0 : -1;
+}
+
+//Sets the least significant bits of carrier bytes "from" up to "to", counted across "height" rows of "rowlength" bytes as in embedRows, to random values.
+//Returns 0 on success, or -1 if no random data could be obtained.
+int scrambleRows(unsigned char **rows, int height, int rowlength, unsigned long long from, unsigned long long to)
+{
+    unsigned char random[256];                  //random bits for the next sizeof(random) * BYTE_SIZE carrier bytes
+
+    for (unsigned long long bit = from; bit < to && bit / rowlength < (unsigned long long)height; bit++)
+    {
+        size_t index = (bit - from) % (sizeof(random) * BYTE_SIZE);
+
+        if (index == 0 && getrandom(random, sizeof(random), 0) != sizeof(random))
+            return -1;
+        writebit((unsigned long)random[index / BYTE_SIZE], rows[bit / rowlength] + bit % rowlength, index % BYTE_SIZE);
+    }
+
+    return 0;
+}
+
+//Returns the number of rows of "rowlength" bytes that embedRows writes to when embedding "payloadsize" bytes.
+int embedRowCount(int rowlength, unsigned long payloadsize)
+{
+    return ((unsigned long long)payloadsize * BYTE_SIZE + MARKER_PLUS_FILESIZE + rowlength - 1) / rowlength;
+}
+
+//Writes each bit of the "length" bytes of "data", least significant first, to the least significant bit of consecutive bytes of "carrier".
+void embedBytes(unsigned char *carrier, const unsigned char *data, size_t length)
+{
+    for (size_t i = 0; i < length * BYTE_SIZE; i++)
+        writebit((unsigned long)data[i / BYTE_SIZE], carrier + i, i % BYTE_SIZE);
+}
+
+//Reassembles "length" bytes into "data" from the least significant bits of consecutive bytes of "carrier", as written by embedBytes.
+void extractBytes(const unsigned char *carrier, unsigned char *data, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        data[i] = 0;
+        for (int bit = 0; bit < BYTE_SIZE; bit++)
+            data[i] |= (carrier[i * BYTE_SIZE + bit] & 1) << bit;
+    }
 }
\ No newline at end of file
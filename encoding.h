@@ -1,4 +1,19 @@
+#include <stdio.h>
 #include <stdlib.h>
+#include <sys/random.h>
+
+#define BYTE_SIZE 8                             //size of a byte, in bits
+#define MARKER 1635021427ul                     //integer that will indicate a file has a hidden payload
+#define MARKER_LENGTH 32                        //length of MARKER, in bits
+#define FILESIZE_LENGTH 32                      //length of the filesize value, in bits
+#define MARKER_PLUS_FILESIZE 64                 //combined length of MARKER_LENGTH and FILESIZE_LENGTH
 
 int ipow(int base, int exp);
-void writebit(unsigned long bitholder, unsigned char *byte, int bitposition);
\ No newline at end of file
+void writebit(unsigned long bitholder, unsigned char *byte, int bitposition);
+unsigned long embedRows(unsigned char **rows, int height, int rowlength, FILE *payload, unsigned long payloadsize);
+int extractRows(unsigned char **rows, int height, int rowlength, FILE *outputFile);
+int extractHeader(unsigned char **rows, int height, int rowlength, unsigned long *payloadsize);
+int scrambleRows(unsigned char **rows, int height, int rowlength, unsigned long long from, unsigned long long to);
+int embedRowCount(int rowlength, unsigned long payloadsize);
+void embedBytes(unsigned char *carrier, const unsigned char *data, size_t length);
+void extractBytes(const unsigned char *carrier, unsigned char *data, size_t length);
\ No newline at end of file
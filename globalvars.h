@@ -1,2 +1,5 @@
 char *exeName;
-int loggingEnabled;
\ No newline at end of file
+int loggingEnabled;
+char *cacheDir;
+int restartInterval;
+int containerMode;
\ No newline at end of file
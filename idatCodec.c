@@ -0,0 +1,319 @@
+#include "idatCodec.h"
+#include "globalvars.h"
+#include "errorHandling.h"
+#include "pngChunks.h"
+
+#define FILTER_NONE 0                           //PNG row filter types
+#define FILTER_SUB 1
+#define FILTER_UP 2
+#define FILTER_AVERAGE 3
+#define FILTER_PAETH 4
+#define FILTER_COUNT 5
+
+
+//Grows "buffer" so that at least "length" more bytes fit after the bytes in use.
+void bufferReserve(byteBuffer *buffer, size_t length)
+{
+    if (buffer->length + length > buffer->capacity)
+    {
+        size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+
+        while (capacity < buffer->length + length)
+            capacity *= 2;
+        if ( !(buffer->data = realloc(buffer->data, capacity)) )
+            error_(1, "%s: [bufferReserve] Cannot allocate %zu bytes.", exeName, capacity);
+        buffer->capacity = capacity;
+    }
+}
+
+//Appends "length" bytes of "data" to "buffer", growing it as needed.
+void bufferAppend(byteBuffer *buffer, const void *data, size_t length)
+{
+    bufferReserve(buffer, length);
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+}
+
+//Frees the memory held by "buffer".
+void bufferFree(byteBuffer *buffer)
+{
+    free(buffer->data);
+    memset(buffer, 0, sizeof(*buffer));
+}
+
+//Returns the number of channels of PNG color type "colorType", or 0 if the color type is invalid.
+int colorChannels(int colorType)
+{
+    switch (colorType)
+    {
+        case 0:                                 //grayscale
+        case 3:                                 //palette
+            return 1;
+        case 4:                                 //grayscale with alpha
+            return 2;
+        case 2:                                 //truecolor
+            return 3;
+        case 6:                                 //truecolor with alpha
+            return 4;
+        default:
+            return 0;
+    }
+}
+
+//Returns whichever of "a" (left), "b" (above) and "c" (upper left) is closest to a + b - c.
+static int paeth(int a, int b, int c)
+{
+    int p = a + b - c;
+    int pa = abs(p - a),
+        pb = abs(p - b),
+        pc = abs(p - c);
+
+    if (pa <= pb && pa <= pc)
+        return a;
+    if (pb <= pc)
+        return b;
+    return c;
+}
+
+//Returns the predictor of filter "type" for byte "i" of "row", given the row above ("prior", NULL for none) and "bpp" bytes per pixel.
+static int predict(int type, const unsigned char *row, const unsigned char *prior, size_t i, int bpp)
+{
+    int a = i >= (size_t)bpp ? row[i - bpp] : 0,
+        b = prior ? prior[i] : 0,
+        c = prior && i >= (size_t)bpp ? prior[i - bpp] : 0;
+
+    switch (type)
+    {
+        case FILTER_SUB:
+            return a;
+        case FILTER_UP:
+            return b;
+        case FILTER_AVERAGE:
+            return (a + b) / 2;
+        case FILTER_PAETH:
+            return paeth(a, b, c);
+        default:
+            return 0;
+    }
+}
+
+//Filters "length" bytes of "row" with filter "type" into "out"; "prior" is the unfiltered row above, or NULL for the first row.
+void filterRow(int type, const unsigned char *row, const unsigned char *prior, size_t length, int bpp, unsigned char *out)
+{
+    for (size_t i = 0; i < length; i++)
+        out[i] = row[i] - predict(type, row, prior, i, bpp);
+}
+
+//Reverses filter "type" on "length" bytes of "row" in place; "prior" is the already unfiltered row above, or NULL for the first row.
+void unfilterRow(int type, unsigned char *row, const unsigned char *prior, size_t length, int bpp)
+{
+    for (size_t i = 0; i < length; i++)
+        row[i] += predict(type, row, prior, i, bpp);
+}
+
+//Returns the filter type giving the smallest sum of absolute filtered values for "row", the same heuristic libpng uses.
+//If "prior" is NULL, only the filters that do not look at the row above are tried.
+static int chooseFilter(const unsigned char *row, const unsigned char *prior, size_t length, int bpp, unsigned char *scratch)
+{
+    int best = FILTER_NONE;
+    unsigned long bestSum = (unsigned long)-1;
+
+    for (int type = FILTER_NONE; type < (prior ? FILTER_COUNT : FILTER_UP); type++)
+    {
+        unsigned long sum = 0;
+
+        filterRow(type, row, prior, length, bpp, scratch);
+        for (size_t i = 0; i < length; i++)
+            sum += scratch[i] < 128 ? scratch[i] : 256 - scratch[i];
+
+        if (sum < bestSum)
+            best = type, bestSum = sum;
+    }
+
+    return best;
+}
+
+//Inflates the raw deflate data at "data" until "outLength" bytes have been written to "out". Returns 0 on success.
+int inflateRaw(const unsigned char *data, size_t length, unsigned char *out, size_t outLength)
+{
+    z_stream stream;
+    int result;
+
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+        return -1;
+
+    stream.next_in = (Bytef *)data;
+    stream.avail_in = length;
+    stream.next_out = out;
+    stream.avail_out = outLength;
+
+    do
+        result = inflate(&stream, Z_NO_FLUSH);
+    while (result == Z_OK && stream.avail_out);
+
+    inflateEnd(&stream);
+    return stream.avail_out == 0 && (result == Z_OK || result == Z_STREAM_END || result == Z_BUF_ERROR) ? 0 : -1;
+}
+
+//Inflates one segment written by compressSegment, the "length" bytes of raw deflate data at "data", into exactly "outLength" bytes at "out".
+//Returns 0 only if the segment ends exactly where its data does: on the final block if "last" is set, or else on the byte-aligned block boundary of a full flush.
+int inflateSegment(const unsigned char *data, size_t length, unsigned char *out, size_t outLength, int last)
+{
+    z_stream stream;
+    int result;
+
+    memset(&stream, 0, sizeof(stream));
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+        return -1;
+
+    stream.next_in = (Bytef *)data;
+    stream.avail_in = length;
+    stream.next_out = out;
+    stream.avail_out = outLength;
+
+    //keep going once the output is full, so that the empty stored block ending a flushed segment is consumed as well
+    do
+        result = inflate(&stream, Z_NO_FLUSH);
+    while (result == Z_OK && stream.avail_in);
+
+    inflateEnd(&stream);
+    if (stream.avail_out || stream.avail_in)
+        return -1;
+    if (last)
+        return result == Z_STREAM_END ? 0 : -1;
+    return result == Z_OK && (stream.data_type & (7 | 64 | 128)) == 128 ? 0 : -1;
+}
+
+//Filters and compresses "rowCount" rows of "rowlength" bytes as one independent raw deflate segment, appended to "out".
+//The first row never refers to the row above, and the segment ends on a byte-aligned full flush (or the final block if "last" is set),
+//so segments can be recompressed or copied verbatim on their own. Filter types are taken from "filterTypes" if given, or chosen per row.
+//Returns the Adler-32 of the filtered data.
+uint32_t compressSegment(unsigned char **rows, int rowCount, size_t rowlength, int bpp, const unsigned char *filterTypes, int last, byteBuffer *out)
+{
+    size_t stride = rowlength + 1;
+    unsigned char *filtered = malloc(rowCount * stride),
+                  *scratch = malloc(rowlength);
+    z_stream stream;
+    uLong adler;
+
+
+
+    for (int y = 0; y < rowCount; y++)
+    {
+        const unsigned char *prior = y ? rows[y - 1] : NULL;
+        int type = filterTypes ? filterTypes[y] : chooseFilter(rows[y], prior, rowlength, bpp, scratch);
+
+        filtered[y * stride] = type;
+        filterRow(type, rows[y], prior, rowlength, bpp, filtered + y * stride + 1);
+    }
+    adler = adler32(adler32(0L, Z_NULL, 0), filtered, rowCount * stride);
+
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        error_(1, "%s: [compressSegment] 'deflateInit2' failed.", exeName);
+
+    //make room for the worst case, plus the empty stored block a full flush emits
+    bufferReserve(out, deflateBound(&stream, rowCount * stride) + 16);
+
+    stream.next_in = filtered;
+    stream.avail_in = rowCount * stride;
+    stream.next_out = out->data + out->length;
+    stream.avail_out = out->capacity - out->length;
+    if (deflate(&stream, last ? Z_FINISH : Z_FULL_FLUSH) != (last ? Z_STREAM_END : Z_OK) || stream.avail_in)
+        error_(1, "%s: [compressSegment] 'deflate' failed.", exeName);
+    out->length += stream.total_out;
+
+    deflateEnd(&stream);
+    free(scratch);
+    free(filtered);
+    return (uint32_t)adler;
+}
+
+//Compresses "height" rows into a complete zlib stream for IDAT, restarting the compressor every "interval" rows.
+//The offset and Adler-32 of each segment are recorded in "table".
+void compressRestartStream(unsigned char **rows, int height, size_t rowlength, int bpp, int interval, byteBuffer *stream, restartTable *table)
+{
+    static const unsigned char zlibHeader[ZLIB_HEADER_LENGTH] = { 0x78, 0x9C };
+    unsigned char trailer[ZLIB_TRAILER_LENGTH];
+    uLong adler = adler32(0L, Z_NULL, 0);
+
+
+
+    table->interval = interval;
+    table->count = (height + interval - 1) / interval;
+    table->offsets = malloc(table->count * sizeof(uint32_t));
+    table->adlers = malloc(table->count * sizeof(uint32_t));
+
+    bufferAppend(stream, zlibHeader, ZLIB_HEADER_LENGTH);
+    for (uint32_t s = 0; s < table->count; s++)
+    {
+        int first = s * interval,
+            count = height - first < interval ? height - first : interval;
+
+        table->offsets[s] = stream->length;
+        table->adlers[s] = compressSegment(rows + first, count, rowlength, bpp, NULL, s + 1 == table->count, stream);
+        adler = adler32_combine(adler, table->adlers[s], (z_off_t)count * (rowlength + 1));
+    }
+
+    putUint32(trailer, (uint32_t)adler);
+    bufferAppend(stream, trailer, ZLIB_TRAILER_LENGTH);
+}
+
+//Compresses "height" rows into a complete zlib stream made of a single segment.
+void compressStream(unsigned char **rows, int height, size_t rowlength, int bpp, byteBuffer *stream)
+{
+    restartTable table;
+
+    compressRestartStream(rows, height, rowlength, bpp, height, stream, &table);
+    restartFree(&table);
+}
+
+//Serializes "table" into "out" as the data of a RESTART_CHUNK chunk.
+void restartEncode(const restartTable *table, byteBuffer *out)
+{
+    unsigned char field[4];
+
+    putUint32(field, table->interval);
+    bufferAppend(out, field, 4);
+    putUint32(field, table->count);
+    bufferAppend(out, field, 4);
+    for (uint32_t s = 0; s < table->count; s++)
+    {
+        putUint32(field, table->offsets[s]);
+        bufferAppend(out, field, 4);
+        putUint32(field, table->adlers[s]);
+        bufferAppend(out, field, 4);
+    }
+}
+
+//Parses the data of a RESTART_CHUNK chunk into "table". Returns 0 on success, or -1 if the chunk is malformed.
+int restartDecode(const unsigned char *data, uint32_t length, restartTable *table)
+{
+    memset(table, 0, sizeof(*table));
+    if (length < 8)
+        return -1;
+
+    table->interval = getUint32(data);
+    table->count = getUint32(data + 4);
+    if (table->interval == 0 || table->count == 0 || (length - 8) / 8 != table->count || (length - 8) % 8)
+        return -1;
+
+    table->offsets = malloc(table->count * sizeof(uint32_t));
+    table->adlers = malloc(table->count * sizeof(uint32_t));
+    for (uint32_t s = 0; s < table->count; s++)
+    {
+        table->offsets[s] = getUint32(data + 8 + s * 8);
+        table->adlers[s] = getUint32(data + 12 + s * 8);
+    }
+
+    return 0;
+}
+
+//Frees the memory held by "table".
+void restartFree(restartTable *table)
+{
+    free(table->offsets);
+    free(table->adlers);
+    memset(table, 0, sizeof(*table));
+}
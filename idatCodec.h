@@ -0,0 +1,39 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+
+#define RESTART_CHUNK "stRP"                    //private, unsafe-to-copy chunk holding a restartTable
+#define ZLIB_HEADER_LENGTH 2                    //length of the zlib stream header, in bytes
+#define ZLIB_TRAILER_LENGTH 4                   //length of the zlib stream's Adler-32 trailer, in bytes
+#define IDAT_CHUNK_SIZE 8192                    //largest amount of the zlib stream written to a single IDAT chunk, in bytes
+
+typedef struct byteBuffer
+{
+    unsigned char *data;                        //start of the buffer
+    size_t length,                              //number of bytes in use
+           capacity;                            //number of bytes allocated
+} byteBuffer;
+
+typedef struct restartTable
+{
+    uint32_t interval,                          //number of rows between restart points
+             count;                             //number of segments (restart points) in the IDAT stream
+    uint32_t *offsets,                          //offset of each segment within the zlib stream carried by IDAT
+             *adlers;                           //Adler-32 of each segment's filtered row data
+} restartTable;
+
+void bufferReserve(byteBuffer *buffer, size_t length);
+void bufferAppend(byteBuffer *buffer, const void *data, size_t length);
+void bufferFree(byteBuffer *buffer);
+int colorChannels(int colorType);
+void filterRow(int type, const unsigned char *row, const unsigned char *prior, size_t length, int bpp, unsigned char *out);
+void unfilterRow(int type, unsigned char *row, const unsigned char *prior, size_t length, int bpp);
+int inflateRaw(const unsigned char *data, size_t length, unsigned char *out, size_t outLength);
+int inflateSegment(const unsigned char *data, size_t length, unsigned char *out, size_t outLength, int last);
+uint32_t compressSegment(unsigned char **rows, int rowCount, size_t rowlength, int bpp, const unsigned char *filterTypes, int last, byteBuffer *out);
+void compressRestartStream(unsigned char **rows, int height, size_t rowlength, int bpp, int interval, byteBuffer *stream, restartTable *table);
+void compressStream(unsigned char **rows, int height, size_t rowlength, int bpp, byteBuffer *stream);
+void restartEncode(const restartTable *table, byteBuffer *out);
+int restartDecode(const unsigned char *data, uint32_t length, restartTable *table);
+void restartFree(restartTable *table);
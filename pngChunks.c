@@ -0,0 +1,114 @@
+#include "pngChunks.h"
+#include "globalvars.h"
+#include "errorHandling.h"
+#include "endianness.h"
+#include <zlib.h>
+
+const unsigned char pngSignature[PNG_SIG_LENGTH] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+
+//Returns the big-endian (network order) 32-bit integer stored at "bytes".
+uint32_t getUint32(const unsigned char *bytes)
+{
+    uint32_t val;
+
+    memcpy(&val, bytes, sizeof(val));
+    return is_little_endian() ? reversed(val) : val;
+}
+
+//Stores "val" at "bytes" as a big-endian (network order) 32-bit integer.
+void putUint32(unsigned char *bytes, uint32_t val)
+{
+    if (is_little_endian())
+        val = reversed(val);
+    memcpy(bytes, &val, sizeof(val));
+}
+
+//Maps the PNG file at "path" into "file" without decoding anything. Returns 0 on success, or -1 if the file cannot be mapped or is not a PNG file.
+int chunkOpen(const char *path, chunkFile *file)
+{
+    int fd;
+    struct stat st;
+
+
+
+    memset(file, 0, sizeof(*file));
+    if ((fd = open(path, O_RDONLY)) == -1)
+        return -1;
+
+    if (fstat(fd, &st) != 0 || st.st_size < PNG_SIG_LENGTH)
+    {
+        close(fd);
+        return -1;
+    }
+
+    file->size = st.st_size;
+    file->data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file->data == MAP_FAILED)
+    {
+        memset(file, 0, sizeof(*file));
+        return -1;
+    }
+
+    //if the file's first 8 bytes are not identical to the PNG magic number, it is not a PNG file
+    if (memcmp(file->data, pngSignature, PNG_SIG_LENGTH) != 0)
+    {
+        chunkClose(file);
+        return -1;
+    }
+
+    return 0;
+}
+
+//Reads the chunk starting at "*offset" into "chunk" and advances "*offset" past it; an "*offset" of 0 starts at the first chunk.
+//Returns 1 if a chunk was read, or 0 at the end of the file or at a truncated chunk. CRCs are not verified.
+int chunkNext(const chunkFile *file, size_t *offset, pngChunk *chunk)
+{
+    if (*offset < PNG_SIG_LENGTH)
+        *offset = PNG_SIG_LENGTH;
+
+    if (*offset > file->size || file->size - *offset < CHUNK_OVERHEAD)
+        return 0;
+
+    chunk->length = getUint32(file->data + *offset);
+    if (chunk->length > file->size - *offset - CHUNK_OVERHEAD)
+        return 0;
+
+    memcpy(chunk->type, file->data + *offset + 4, 4);
+    chunk->type[4] = '\0';
+    chunk->data = file->data + *offset + 8;
+    chunk->offset = *offset;
+    chunk->total = chunk->length + CHUNK_OVERHEAD;
+
+    *offset += chunk->total;
+    return 1;
+}
+
+//Unmaps the file held by "file".
+void chunkClose(chunkFile *file)
+{
+    if (file->data)
+        munmap(file->data, file->size);
+    memset(file, 0, sizeof(*file));
+}
+
+//Writes a complete chunk of type "type" holding "length" bytes of "data" to "outputFile". Returns 0 on success.
+int chunkWrite(FILE *outputFile, const char *type, const unsigned char *data, uint32_t length)
+{
+    unsigned char field[4];
+    uLong crc;
+
+    putUint32(field, length);
+    if (fwrite(field, 1, 4, outputFile) != 4 || fwrite(type, 1, 4, outputFile) != 4)
+        return -1;
+    if (length && fwrite(data, 1, length, outputFile) != length)
+        return -1;
+
+    //the CRC covers the chunk type and data, but not the length
+    crc = crc32(0L, (const Bytef *)type, 4);
+    if (length)
+        crc = crc32(crc, data, length);
+    putUint32(field, (uint32_t)crc);
+    return fwrite(field, 1, 4, outputFile) == 4 ? 0 : -1;
+}
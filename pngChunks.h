@@ -0,0 +1,34 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define PNG_SIG_LENGTH 8                        //length of the PNG magic number, in bytes
+#define CHUNK_OVERHEAD 12                       //length, type and CRC fields surrounding the data of every chunk, in bytes
+
+typedef struct chunkFile
+{
+    unsigned char *data;                        //read-only mapping of the whole file
+    size_t size;                                //size of the file, in bytes
+} chunkFile;
+
+typedef struct pngChunk
+{
+    char type[5];                               //four-letter chunk type, NUL-terminated
+    uint32_t length;                            //length of the chunk data, in bytes
+    const unsigned char *data;                  //start of the chunk data within the mapping
+    size_t offset;                              //offset of the whole chunk (starting at its length field) within the file
+    size_t total;                               //length of the whole chunk, including CHUNK_OVERHEAD
+} pngChunk;
+
+extern const unsigned char pngSignature[PNG_SIG_LENGTH];
+
+int chunkOpen(const char *path, chunkFile *file);
+int chunkNext(const chunkFile *file, size_t *offset, pngChunk *chunk);
+void chunkClose(chunkFile *file);
+int chunkWrite(FILE *outputFile, const char *type, const unsigned char *data, uint32_t length);
+uint32_t getUint32(const unsigned char *bytes);
+void putUint32(unsigned char *bytes, uint32_t val);
@@ -3,13 +3,12 @@
 #include "errorHandling.h"
 #include "globalvars.h"
 #include "encoding.h"
-
-#define PNG_SIG_LENGTH 8                        //length of the PNG magic number, in bytes
-#define BYTE_SIZE 8                             //size of a byte, in bits
-#define MARKER 1635021427ul                     //integer that will indicate a file has a hidden payload
-#define MARKER_LENGTH 32                        //length of MARKER, in bits
-#define FILESIZE_LENGTH 32                      //length of the filesize value, in bits
-#define MARKER_PLUS_FILESIZE 64                 //combined length of MARKER_LENGTH and FILESIZE_LENGTH
+#include "carrierCache.h"
+#include "pngChunks.h"
+#include "idatCodec.h"
+#include "apng.h"
+#include "container.h"
+#include "carrier.h"
 
 
 typedef struct pngReader
@@ -23,10 +22,147 @@ typedef struct pngReader
         bit_depth,                              //bit depth of the image
         color_type,                             //the PNG file's color type, represented as an integer
         channels;                               //number of color channels in the PNG file
+
+    cacheView cache;                            //pixel data owned by the carrier cache, if the rows were read through it
 } pngReader;
 
 
-static pngReader readPNG(const char *inputPath)
+//Reads the ancillary chunks that follow the image data of the PNG at "inputPath" into reader->info_ptr, as "png_read_end" would,
+//without inflating IDAT: the chunks are copied behind a stand-in 1x1 image, which is read with a libpng structure of its own.
+static void readTrailingChunks(pngReader *reader, const char *inputPath)
+{
+    static const unsigned char header[13] = { 0, 0, 0, 1, 0, 0, 0, 1, 8, 0, 0, 0, 0 },    //IHDR data of a 1x1, 8-bit grayscale image
+                               pixel[2] = { 0, 0 };                                       //its only row: filter type and sample
+    chunkFile carrier;                          //mapping of the file at location inputPath
+    pngChunk chunk;                             //chunk currently being read from carrier
+    size_t offset = 0,                          //offset of the next chunk to read from carrier
+           tailStart = 0,                       //offset of the first chunk after the last IDAT chunk
+           tailEnd = 0;                         //offset of the IEND chunk
+    unsigned char idat[16];                     //zlib stream of the stand-in image
+    uLongf idatLength = sizeof(idat);
+    char *image = NULL;                         //stand-in image, in memory
+    size_t imageLength = 0;
+    FILE *imageFile;
+    png_structp read_ptr;
+    png_infop info_ptr;
+    png_textp text;
+    png_timep time;
+    png_bytep exif;
+    png_uint_32 exifLength;
+    int textCount, failed;
+
+
+
+    if (chunkOpen(inputPath, &carrier) != 0)
+        return;
+    while (chunkNext(&carrier, &offset, &chunk) && strcmp(chunk.type, "IEND") != 0)
+    {
+        if (strcmp(chunk.type, "IDAT") == 0)
+            tailStart = offset;
+        tailEnd = offset;
+    }
+
+    //most carriers have nothing between their image data and IEND
+    if (tailEnd <= tailStart)
+    {
+        chunkClose(&carrier);
+        return;
+    }
+
+    if ( !(imageFile = open_memstream(&image, &imageLength)) || compress(idat, &idatLength, pixel, sizeof(pixel)) != Z_OK)
+        error_(1, "%s: [readPNG] Cannot read the chunks following the image data of '%s'.", exeName, inputPath);
+    failed = fwrite(pngSignature, 1, PNG_SIG_LENGTH, imageFile) != PNG_SIG_LENGTH
+        || chunkWrite(imageFile, "IHDR", header, sizeof(header))
+        || chunkWrite(imageFile, "IDAT", idat, idatLength)
+        || fwrite(carrier.data + tailStart, 1, tailEnd - tailStart, imageFile) != tailEnd - tailStart
+        || chunkWrite(imageFile, "IEND", NULL, 0);
+    failed |= (fclose(imageFile) != 0);
+    chunkClose(&carrier);
+    if (failed)
+    {
+        free(image);
+        error_(1, "%s: [readPNG] Cannot read the chunks following the image data of '%s'.", exeName, inputPath);
+    }
+
+    if ( !(imageFile = fmemopen(image, imageLength, "rb")) || !(read_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL)) )
+        error_(1, "%s: [readPNG] Cannot read the chunks following the image data of '%s'.", exeName, inputPath);
+    if ( !(info_ptr = png_create_info_struct(read_ptr)) )
+    {
+        png_destroy_read_struct(&read_ptr, (png_infopp)NULL, (png_infopp)NULL);
+        error_(1, "%s: [readPNG] 'png_create_info_struct' (info_ptr) failed.", exeName);
+    }
+
+    //if reading the stand-in image fails, jump back here to destroy its png_struct structure, free it and exit the program
+    if (setjmp(png_jmpbuf(read_ptr)))
+    {
+        png_destroy_read_struct(&read_ptr, &info_ptr, (png_infopp)NULL);
+        fclose(imageFile);
+        free(image);
+        error_(1, "%s: [readPNG] Error during 'read_end'.", exeName);
+    }
+    png_init_io(read_ptr, imageFile);
+    png_read_png(read_ptr, info_ptr, PNG_TRANSFORM_IDENTITY, NULL);
+
+    //these are the only chunks libpng keeps from after the image data
+    if (png_get_text(read_ptr, info_ptr, &text, &textCount) > 0)
+        png_set_text(reader->read_ptr, reader->info_ptr, text, textCount);
+    if (png_get_tIME(read_ptr, info_ptr, &time))
+        png_set_tIME(reader->read_ptr, reader->info_ptr, time);
+    if (png_get_eXIf_1(read_ptr, info_ptr, &exifLength, &exif))
+        png_set_eXIf_1(reader->read_ptr, reader->info_ptr, exifLength, exif);
+
+    png_destroy_read_struct(&read_ptr, &info_ptr, (png_infopp)NULL);
+    fclose(imageFile);
+    free(image);
+}
+
+//Decodes the pixel data of "inputFile" (at "inputPath") through the carrier cache at "cachePath", reusing a previously decoded copy when one exists.
+static void readCachedPNG(pngReader *reader, FILE *inputFile, const char *inputPath, const char *cachePath)
+{
+    int height;                                 //height of the image in pixels
+    size_t rowbytes;                            //length of each decoded row, in bytes
+
+
+
+    //if "png_read_image" fails, jump back here to destroy the read png_struct structure, release the cached rows, close inputFile and exit the program
+    if (setjmp(png_jmpbuf(reader->read_ptr)))
+    {
+        png_destroy_read_struct(&reader->read_ptr, &reader->info_ptr, (png_infopp)NULL);
+        cacheRelease(&reader->cache);
+        fclose(inputFile);
+        error_(1, "%s: [readPNG] Error during 'read_image'.", exeName);
+    }
+    //read only the chunks preceding the image data, so that a cache hit never inflates IDAT
+    png_read_info(reader->read_ptr, reader->info_ptr);
+    png_set_interlace_handling(reader->read_ptr);
+    png_read_update_info(reader->read_ptr, reader->info_ptr);
+
+    height = png_get_image_height(reader->read_ptr, reader->info_ptr);
+    rowbytes = png_get_rowbytes(reader->read_ptr, reader->info_ptr);
+
+    //carriers readPNG is about to reject are neither decoded nor cached
+    if (png_get_bit_depth(reader->read_ptr, reader->info_ptr) != BYTE_SIZE)
+    {
+        reader->row_pointers = NULL;
+        return;
+    }
+
+    //on a cache miss, decode the image into fresh rows and store them for the next job
+    if (!cacheLoad(cachePath, fileno(inputFile), height, rowbytes, &reader->cache))
+    {
+        cacheAlloc(height, rowbytes, &reader->cache);
+        png_read_image(reader->read_ptr, reader->cache.rows);
+        png_read_end(reader->read_ptr, reader->info_ptr);
+        cacheStore(cachePath, fileno(inputFile), &reader->cache, height, rowbytes);
+    }
+    //on a hit the image data is skipped, so pick up the chunks after it separately for the package to match a miss
+    else
+        readTrailingChunks(reader, inputPath);
+
+    reader->row_pointers = reader->cache.rows;
+}
+
+static pngReader readPNG(const char *inputPath, const char *cachePath)
 {
     FILE *inputFile;                            //pointer to the file at location inputPath
     unsigned char sigBuffer[BYTE_SIZE];         //char array to read inputFile's first 8 bytes into
@@ -34,6 +170,8 @@ static pngReader readPNG(const char *inputPath)
 
 
 
+    memset(&reader.cache, 0, sizeof(reader.cache));
+
     //if inputFile cannot be opened, exit the program
     if ( !(inputFile = fopen(inputPath, "rb")) )
         error_(1, "%s: [readPNG] Cannot open '%s'.", exeName, inputPath);
@@ -74,18 +212,24 @@ static pngReader readPNG(const char *inputPath)
     //set the first eight bytes of inputFile as already read
     png_set_sig_bytes(reader.read_ptr, PNG_SIG_LENGTH);
 
-    //if "png_read_png" fails, jump back here to destroy the read png_struct structure, close inputFile and exit the program
-    if (setjmp(png_jmpbuf(reader.read_ptr)))
+    //if a cache directory was given, read inputFile through the carrier cache
+    if (cachePath)
+        readCachedPNG(&reader, inputFile, inputPath, cachePath);
+    else
     {
-        png_destroy_read_struct(&reader.read_ptr, &reader.info_ptr, (png_infopp)NULL);
-        fclose(inputFile);
-        error_(1, "%s: [readPNG] Error during 'read_png'.", exeName);
-    }
-    //read inputFile
-    png_read_png(reader.read_ptr, reader.info_ptr, PNG_TRANSFORM_IDENTITY, NULL);
+        //if "png_read_png" fails, jump back here to destroy the read png_struct structure, close inputFile and exit the program
+        if (setjmp(png_jmpbuf(reader.read_ptr)))
+        {
+            png_destroy_read_struct(&reader.read_ptr, &reader.info_ptr, (png_infopp)NULL);
+            fclose(inputFile);
+            error_(1, "%s: [readPNG] Error during 'read_png'.", exeName);
+        }
+        //read inputFile
+        png_read_png(reader.read_ptr, reader.info_ptr, PNG_TRANSFORM_IDENTITY, NULL);
 
-    //retrieve image data from info_ptr
-    reader.row_pointers = png_get_rows(reader.read_ptr, reader.info_ptr);
+        //retrieve image data from info_ptr
+        reader.row_pointers = png_get_rows(reader.read_ptr, reader.info_ptr);
+    }
 
     //retrieve inputFile's width, height, bit depth, color type, and number of color channels
     reader.width = png_get_image_width(reader.read_ptr, reader.info_ptr);
@@ -109,6 +253,97 @@ static pngReader readPNG(const char *inputPath)
     return reader;
 }
 
+//Writes "text" as a tEXt, zTXt or iTXt chunk, as its compression field asks.
+static void writeTextChunk(png_structp write_ptr, const png_text *text)
+{
+    byteBuffer data = { 0 };                    //chunk data
+    const char *body = text->text ? text->text : "";
+    int international = text->compression >= PNG_ITXT_COMPRESSION_NONE,
+        compressed = text->compression == PNG_TEXT_COMPRESSION_zTXt || text->compression == PNG_ITXT_COMPRESSION_zTXt;
+
+
+
+    bufferAppend(&data, text->key, strlen(text->key) + 1);
+    if (international)
+    {
+        const unsigned char flags[2] = { compressed, 0 };   //compression flag and method
+
+        bufferAppend(&data, flags, sizeof(flags));
+        bufferAppend(&data, text->lang ? text->lang : "", strlen(text->lang ? text->lang : "") + 1);
+        bufferAppend(&data, text->lang_key ? text->lang_key : "", strlen(text->lang_key ? text->lang_key : "") + 1);
+    }
+    else if (compressed)
+        bufferAppend(&data, "", 1);             //compression method
+
+    if (compressed)
+    {
+        uLongf length = compressBound(strlen(body));
+
+        bufferReserve(&data, length);
+        if (compress(data.data + data.length, &length, (const Bytef *)body, strlen(body)) != Z_OK)
+            png_error(write_ptr, "Cannot compress text chunk");
+        data.length += length;
+    }
+    else
+        bufferAppend(&data, body, strlen(body));
+
+    png_write_chunk(write_ptr, (png_const_bytep)(international ? "iTXt" : compressed ? "zTXt" : "tEXt"), data.data, data.length);
+    bufferFree(&data);
+}
+
+//Writes the chunks "png_write_end" would write after the image data, then IEND. "png_write_end" itself cannot be used,
+//since libpng refuses to finish a file whose image data it did not write. "png_write_info" has already written tIME and eXIf,
+//and marked every text it wrote, so what is left are the texts it has not written and the chunks kept for after the image data.
+static void writeTrailingChunks(png_structp write_ptr, png_infop info_ptr)
+{
+    png_textp text;
+    png_unknown_chunkp unknowns;
+    int count;
+
+    count = png_get_text(write_ptr, info_ptr, &text, NULL);
+    for (int i = 0; i < count; i++)
+        if (text[i].compression >= PNG_TEXT_COMPRESSION_NONE)
+            writeTextChunk(write_ptr, &text[i]);
+
+    count = png_get_unknown_chunks(write_ptr, info_ptr, &unknowns);
+    for (int i = 0; i < count; i++)
+        if (unknowns[i].location & PNG_AFTER_IDAT)
+            png_write_chunk(write_ptr, unknowns[i].name, unknowns[i].data, unknowns[i].size);
+
+    png_write_chunk(write_ptr, (png_const_bytep)"IEND", NULL, 0);
+}
+
+//Writes the image in "inputPNG" with its IDAT stream compressed in independent segments of restartInterval rows,
+//followed by a RESTART_CHUNK chunk recording where each segment starts, so that pngUpdate can later recompress only the segments it changes.
+static void writeRestartPNG(png_structp write_ptr, pngReader *inputPNG)
+{
+    byteBuffer stream = { 0 },                  //zlib stream that will be split across the IDAT chunks
+               tableData = { 0 };               //serialized restart table
+    restartTable table;                         //offset and checksum of each segment of stream
+
+
+
+    //restart points are row-based, so the package is never interlaced
+    png_set_IHDR(write_ptr, inputPNG->info_ptr, inputPNG->width, inputPNG->height, inputPNG->bit_depth, inputPNG->color_type,
+        PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(write_ptr, inputPNG->info_ptr);
+
+    compressRestartStream(inputPNG->row_pointers, inputPNG->height, inputPNG->width * inputPNG->channels, inputPNG->channels,
+        restartInterval, &stream, &table);
+    for (size_t offset = 0; offset < stream.length; offset += IDAT_CHUNK_SIZE)
+        png_write_chunk(write_ptr, (png_const_bytep)"IDAT", stream.data + offset,
+            stream.length - offset < IDAT_CHUNK_SIZE ? stream.length - offset : IDAT_CHUNK_SIZE);
+
+    restartEncode(&table, &tableData);
+    png_write_chunk(write_ptr, (png_const_bytep)RESTART_CHUNK, tableData.data, tableData.length);
+
+    writeTrailingChunks(write_ptr, inputPNG->info_ptr);
+
+    restartFree(&table);
+    bufferFree(&tableData);
+    bufferFree(&stream);
+}
+
 static void writePNG(pngReader *inputPNG, char *outputPath)
 {
     FILE *outputFile;                           //file pointer to file at location outputPath
@@ -150,6 +385,24 @@ static void writePNG(pngReader *inputPNG, char *outputPath)
     //initialize input/output for outputFile
     png_init_io(write_ptr, outputFile);
 
+    //if restart points were requested, compress the image data here instead of in "png_write_png"
+    if (restartInterval > 0)
+    {
+        //if writing fails, jump back here to destroy the read and write png_struct structures, delete outputFile and exit the program
+        if (setjmp(png_jmpbuf(write_ptr)))
+        {
+            png_destroy_write_struct(&write_ptr, &inputPNG->info_ptr);
+            png_destroy_read_struct(&inputPNG->read_ptr, &inputPNG->info_ptr, (png_infopp)NULL);
+            fremove(outputFile, outputPath);
+            error_(1, "%s: [writePNG] Error during 'write_restart'.", exeName);
+        }
+        writeRestartPNG(write_ptr, inputPNG);
+
+        fclose(outputFile);
+        png_destroy_write_struct(&write_ptr, &inputPNG->info_ptr);
+        return;
+    }
+
     //put the image data from row_pointers into the png_info structure
     png_set_rows(write_ptr, inputPNG->info_ptr, inputPNG->row_pointers);
 
@@ -175,14 +428,26 @@ void pngEncode(const char *carrierPath, const char *payloadPath, char *outputPat
 {
     pngReader carrier;                          //pngReader container that will hold the information of the file at location carrierPath
     FILE *payload;                              //pointer to the file at location payloadPath
-    FILE *herp, *derp;
     unsigned long payloadsize = 0;              //size of file "payload" in bytes
-    unsigned char bytebuffer = 0;               //buffer to hold the payload byte currently being written
+    carrierFormat format;                       //format of the file at location carrierPath, judged by its magic number
+
+
 
+    //uncompressed carriers are embedded into through a mapping of their pixel data, without libpng
+    format = carrierDetect(carrierPath);
+    if (format != CARRIER_PNG && format != CARRIER_UNKNOWN)
+        return rawEncode(carrierPath, payloadPath, outputPath);
 
+    //in container mode the payload is stored in chunks of its own and the pixel data is never touched
+    if (containerMode)
+        return containerEncode(carrierPath, payloadPath, outputPath);
 
-    //initialize carrier
-    carrier = readPNG(carrierPath);
+    //animated carriers are embedded frame by frame instead
+    if (isAPNG(carrierPath))
+        return apngEncode(carrierPath, payloadPath, outputPath);
+
+    //initialize carrier, through the carrier cache if one is enabled
+    carrier = readPNG(carrierPath, cacheDir);
 
     //if the initialization of payload fails, exit the program
     if ( !(payload = fopen(payloadPath, "rb")) )
@@ -194,69 +459,17 @@ void pngEncode(const char *carrierPath, const char *payloadPath, char *outputPat
     if ((carrier.width * carrier.height * carrier.channels) < (payloadsize * 8 + MARKER_PLUS_FILESIZE))
         error_(1, "%s: [pngEncode] Payload will not fit in carrier.", exeName);
 
-    if (loggingEnabled)
-    {
-        herp = fopen("herpcarrier.log", "w");
-        derp = fopen("derpcarrier.log", "w");
-    }
-
-    //iterate through each row of the carrier image pixel data
-    for (int y = 0; y < carrier.height; y++)
-    {
-        //reset the column position to 0 for each new row
-        int x = 0;
+    //embed the marker, payloadsize and payload into the least significant bits of the carrier image pixel data
+    embedRows(carrier.row_pointers, carrier.height, carrier.width * carrier.channels, payload, payloadsize);
 
-        //if we are on the first row of pixels, encode our marker number and "payloadsize" before doing anything else
-        if (y == 0)
-        {
-            for (x = x; x < MARKER_PLUS_FILESIZE; x++)
-            {
-                if (loggingEnabled)
-                    fwrite(carrier.row_pointers[y]+x, 1, 1, herp);
-
-                if (x < MARKER_LENGTH)
-                    writebit(MARKER, (unsigned char *)(carrier.row_pointers[y]+x), x);
-                else
-                    writebit(payloadsize, (unsigned char *)(carrier.row_pointers[y]+x), x - MARKER_LENGTH);
-
-                if (loggingEnabled)
-                    fwrite(carrier.row_pointers[y]+x, 1, 1, derp);
-            }
-        }
-
-        //each row of bytes has a length equivalent to the width of the carrier image times its number of color channels
-        for (x = x; x < carrier.width * carrier.channels; x++)
-        {
-            //if no payload bytes have been written on this row, or if the payload byte in "bytebuffer" has been fully written, attempt to read in another byte from the payload
-            if (x % BYTE_SIZE == 0)
-                //if there are no more payload bytes left to read in, or if no more payload bytes can be read in, stop iterating through the carrier image pixel data
-                if (!fread(&bytebuffer, 1, 1, payload))
-                    goto LOOP_END;
-
-            if (loggingEnabled)
-                fwrite(carrier.row_pointers[y]+x, 1, 1, herp);
-
-            //write the appropriate bit of bytebuffer to the least significant position of the current carrier byte
-            writebit((unsigned long)bytebuffer, (unsigned char *)(carrier.row_pointers[y]+x), x % BYTE_SIZE);
-
-            if (loggingEnabled)
-                fwrite(carrier.row_pointers[y]+x, 1, 1, derp);
-        }
-    }
-
-    LOOP_END:
     //create a new file at location outputPath and write to it our generated package image
     writePNG(&carrier, outputPath);
 
-    if (loggingEnabled)
-    {
-        fclose(herp);
-        fclose(derp);
-    }
     //close the payload file
     fclose(payload);
-    //destroy read png_struct structure
+    //destroy read png_struct structure and release the private view of any cached rows
     png_destroy_read_struct(&carrier.read_ptr, &carrier.info_ptr, (png_infopp)NULL);
+    cacheRelease(&carrier.cache);
 
     return;
 }
@@ -265,14 +478,24 @@ void pngDecode(const char *packagePath, char *outputPath)
 {
     pngReader package;
     FILE *outputFile;
-    FILE *herpderp;
-    unsigned long markervalue = 0,
-                  payloadsize = 0;
-    unsigned char bytebuffer = 0;
+    carrierFormat format;
+
+
+    //uncompressed packages are extracted through a mapping of their pixel data, without libpng
+    format = carrierDetect(packagePath);
+    if (format != CARRIER_PNG && format != CARRIER_UNKNOWN)
+        return rawDecode(packagePath, outputPath);
+
+    //packages written in container mode hold the payload in chunks of its own, which are extracted without decoding anything
+    if (containerDecode(packagePath, outputPath))
+        return;
 
+    //animated packages carry a frame table and are extracted frame by frame instead
+    if (isAPNG(packagePath))
+        return apngDecode(packagePath, outputPath);
 
     //read in information from the package PNG file
-    package = readPNG(packagePath);
+    package = readPNG(packagePath, NULL);
 
     //exit the program if a file already exists at location outputPath, or if a file cannot be created at outputPath
     if (favailable(outputPath))
@@ -283,64 +506,219 @@ void pngDecode(const char *packagePath, char *outputPath)
     else
         error_(1, "%s: [pngDecode] file '%s' already exists.", exeName, outputPath);
 
-    if (loggingEnabled)
-        herpderp = fopen("herpderpcarrier.log", "w");
+    //extract the payload; if the marker is not found, then a package file embedded by this program was not found; destroy the read png_struct structure and exit the program
+    if (extractRows(package.row_pointers, package.height, package.width * package.channels, outputFile) != 0)
+    {
+        png_destroy_read_struct(&package.read_ptr, &package.info_ptr, (png_infopp)NULL);
+        fclose(outputFile);
+        error_(1, "%s: [pngDecode] file '%s' does not contain a file embedded by this program.", exeName, packagePath);
+    }
+
+    fclose(outputFile);
+
+    return;
+}
+
+//Inflates segment "s" of "stream", the IDAT stream of a package with restart points "table", into "decoded", which holds "height" rows
+//of "rowlength" bytes plus their filter type byte, then unfilters its rows, recording their filter types in "filterTypes".
+//Returns 0 on success, or -1 if the segment does not end exactly at the next restart point or does not match its recorded checksum.
+static int decodeSegment(const byteBuffer *stream, const restartTable *table, uint32_t s, int height, int rowlength, int channels,
+    unsigned char *decoded, unsigned char *filterTypes)
+{
+    size_t stride = rowlength + 1,
+           end = s + 1 < table->count ? table->offsets[s + 1] : stream->length - ZLIB_TRAILER_LENGTH;
+    int first = s * table->interval,
+        count = height - first < (int)table->interval ? height - first : (int)table->interval;
+    unsigned char *segment = decoded + first * stride;
+
+
+
+    if (inflateSegment(stream->data + table->offsets[s], end - table->offsets[s], segment, count * stride, s + 1 == table->count) != 0
+        || adler32(adler32(0L, Z_NULL, 0), segment, count * stride) != table->adlers[s])
+        return -1;
 
-    //itherate through row_pointers
-    for (int y = 0; y < package.height; y++)
+    //the first row of a segment must not depend on the segment before it
+    for (int y = first; y < first + count; y++)
     {
-        //reset column position to 0 for each row
-        int x = 0;
+        filterTypes[y] = decoded[y * stride];
+        if (filterTypes[y] > 4 || (y == first && filterTypes[y] > 1))
+            return -1;
+        unfilterRow(filterTypes[y], decoded + y * stride + 1, y > first ? decoded + (y - 1) * stride + 1 : NULL, rowlength, channels);
+    }
 
-        //do these things before writing anything to outputFile
-        if (y == 0)
+    return 0;
+}
+
+void pngUpdate(const char *packagePath, const char *payloadPath, char *outputPath)
+{
+    chunkFile package;                          //mapping of the file at location packagePath
+    pngChunk chunk;                             //chunk currently being read from package
+    FILE *payload, *outputFile;
+    byteBuffer stream = { 0 },                  //zlib stream carried by the IDAT chunks of package
+               newStream = { 0 },               //zlib stream that will be carried by the IDAT chunks of outputFile
+               tableData = { 0 };               //serialized restart table of outputFile
+    restartTable table = { 0 };                 //restart table of package, updated in place for outputFile
+    size_t offset = 0,                          //offset of the next chunk to read from package
+           idatStart = 0,                       //offset of the first IDAT chunk within package
+           idatEnd = 0,                         //offset just past the last IDAT chunk within package
+           stride, decodedLength;
+    unsigned long payloadsize = 0,              //size of file "payload" in bytes
+                  oldsize;                      //size of the payload package already holds
+    int width = 0, height = 0, bitDepth = 0, colorType = 0, interlace = 0, haveTable = 0,
+        channels, rowlength, segments, decodedRows, lastRow, failed;
+    unsigned char *decoded, *original, *filterTypes;
+    unsigned char **rows;
+    uLong adler = adler32(0L, Z_NULL, 0);
+
+
+
+    //walk the chunks of package without decoding any image data
+    if (chunkOpen(packagePath, &package) != 0)
+        error_(1, "%s: [pngUpdate] '%s' is not a PNG file.", exeName, packagePath);
+    while (chunkNext(&package, &offset, &chunk))
+    {
+        if (strcmp(chunk.type, "IHDR") == 0 && chunk.length == 13)
         {
-            for (x = x; x < MARKER_PLUS_FILESIZE; x++)
-            {
-                //if the completed markervalue is not equal to MARKER, then a package file embedded by this program was not found; destroy the read png_struct structure, close log file if logging is enabled, and exit the program.
-                if (x == MARKER_LENGTH)
-                    if (markervalue != MARKER)
-                    {
-                        png_destroy_read_struct(&package.read_ptr, &package.info_ptr, (png_infopp)NULL);
-                        if (loggingEnabled)
-                            fclose(herpderp);
-                        error_(1, "%s: [pngDecode] file '%s' does not contain a file embedded by this program.", exeName, packagePath);
-                    }
-
-                if (loggingEnabled)
-                    fwrite(package.row_pointers[y]+x, 1, 1, herpderp);
-
-                //if not all bits of markervalue have been assigned, assign this bit to the appropriate bit position in markervalue; otherwise, assign this bit to the appropriate bit position in payloadsize
-                if (x < MARKER_LENGTH)
-                    markervalue |= ( ( *(package.row_pointers[y]+x) & 1) << x);
-                else
-                    payloadsize |= ( ( *(package.row_pointers[y]+x) & 1) << (x - MARKER_LENGTH));
-            }
+            width = getUint32(chunk.data);
+            height = getUint32(chunk.data + 4);
+            bitDepth = chunk.data[8];
+            colorType = chunk.data[9];
+            interlace = chunk.data[12];
         }
-
-        //iterate through row_pointers[y]
-        for (x = x; x < package.width * package.channels; x++)
+        else if (strcmp(chunk.type, "IDAT") == 0)
         {
-            if (loggingEnabled)
-                fwrite(package.row_pointers[y]+x, 1, 1, herpderp);
+            if (!idatStart)
+                idatStart = chunk.offset;
+            idatEnd = offset;
+            bufferAppend(&stream, chunk.data, chunk.length);
+        }
+        else if (strcmp(chunk.type, RESTART_CHUNK) == 0)
+            haveTable = (restartDecode(chunk.data, chunk.length, &table) == 0);
+        else if (strcmp(chunk.type, "IEND") == 0)
+            break;
+    }
 
-            //if all 8 bits in bytebuffer have been set, write the byte to outputFile and clear bytebuffer
-            if ((x > MARKER_PLUS_FILESIZE || y > 0) && x % BYTE_SIZE == 0)
-                fwrite(&bytebuffer, 1, 1, outputFile), bytebuffer = 0;
+    channels = colorChannels(colorType);
+    rowlength = width * channels;
+    stride = rowlength + 1;
+
+    //only packages written with restart points (and so never interlaced) can be updated in place
+    if (!haveTable || !idatStart || bitDepth != BYTE_SIZE || interlace || !channels)
+        error_(1, "%s: [pngUpdate] '%s' was not encoded with restart points (-r).", exeName, packagePath);
+    if (table.count != (uint32_t)(height + table.interval - 1) / table.interval || table.offsets[0] != ZLIB_HEADER_LENGTH
+        || stream.length < table.offsets[table.count - 1] + ZLIB_TRAILER_LENGTH)
+        error_(1, "%s: [pngUpdate] Restart points of '%s' do not match its image data.", exeName, packagePath);
+    for (uint32_t s = 0; s < table.count; s++)
+    {
+        if (s && table.offsets[s] <= table.offsets[s - 1])
+            error_(1, "%s: [pngUpdate] Restart points of '%s' do not match its image data.", exeName, packagePath);
+        adler = adler32_combine(adler, table.adlers[s], (z_off_t)(height - s * table.interval < table.interval ? height - s * table.interval : table.interval) * stride);
+    }
+    //the segment checksums must add up to the checksum of the whole stream, since segments that are not inflated are trusted to them
+    if (adler != getUint32(stream.data + stream.length - ZLIB_TRAILER_LENGTH))
+        error_(1, "%s: [pngUpdate] Restart points of '%s' do not match its image data.", exeName, packagePath);
+    adler = adler32(0L, Z_NULL, 0);
 
-            //if all bits of the payload have been written, exit the loop
-            if ((package.width * y * package.channels + x) == payloadsize * BYTE_SIZE + MARKER_PLUS_FILESIZE)
-                goto LOOP_END;
+    //if the initialization of payload fails, exit the program
+    if ( !(payload = fopen(payloadPath, "rb")) )
+        error_(1, "%s: [pngUpdate] Could not read in payload.", exeName);
+    else
+        payloadsize = fsize(payloadPath);
 
-            //use the LSB of the current package byte to set the appropriate bit position in bytebuffer 
-            bytebuffer |= ((*(package.row_pointers[y]+x) & 1) << x % BYTE_SIZE);
-        }
+    //the same capacity rule as pngEncode
+    if (((unsigned long)rowlength * height) < (payloadsize * 8 + MARKER_PLUS_FILESIZE))
+        error_(1, "%s: [pngUpdate] Payload will not fit in package.", exeName);
+
+    //room is made for every row, but only the segments holding the old or the new payload are ever inflated
+    decoded = malloc((size_t)height * stride);
+    filterTypes = malloc(height);
+    rows = malloc(height * sizeof(unsigned char *));
+    if (!decoded || !filterTypes || !rows)
+        error_(1, "%s: [pngUpdate] Cannot allocate %zu bytes.", exeName, (size_t)height * stride);
+    for (int y = 0; y < height; y++)
+        rows[y] = decoded + y * stride + 1;
+
+    //inflate the segments holding the marker and size first, to learn how far the payload being replaced reaches
+    for (segments = 0; segments * table.interval < (uint32_t)embedRowCount(rowlength, 0); segments++)
+        if (decodeSegment(&stream, &table, segments, height, rowlength, channels, decoded, filterTypes) != 0)
+            error_(1, "%s: [pngUpdate] Restart points of '%s' do not match its image data.", exeName, packagePath);
+    if (extractHeader(rows, height, rowlength, &oldsize) != 0)
+        oldsize = 0;
+
+    //then the rest of the segments either payload is embedded into
+    lastRow = embedRowCount(rowlength, oldsize > payloadsize ? oldsize : payloadsize);
+    for (; segments * table.interval < (uint32_t)lastRow && segments < (int)table.count; segments++)
+        if (decodeSegment(&stream, &table, segments, height, rowlength, channels, decoded, filterTypes) != 0)
+            error_(1, "%s: [pngUpdate] Restart points of '%s' do not match its image data.", exeName, packagePath);
+    decodedRows = segments * (int)table.interval < height ? segments * (int)table.interval : height;
+    decodedLength = decodedRows * stride;
+    original = malloc(decodedLength);
+    memcpy(original, decoded, decodedLength);
+
+    //embed the marker, payloadsize and payload exactly as pngEncode would
+    if (embedRows(rows, decodedRows, rowlength, payload, payloadsize) != payloadsize)
+        error_(1, "%s: [pngUpdate] Payload will not fit in package.", exeName);
+    fclose(payload);
+
+    //overwrite whatever is left of a longer old payload, so that none of it can be read back from the package
+    if (oldsize > payloadsize && scrambleRows(rows, decodedRows, rowlength, payloadsize * 8ull + MARKER_PLUS_FILESIZE, oldsize * 8ull + MARKER_PLUS_FILESIZE) != 0)
+        error_(1, "%s: [pngUpdate] Could not erase the old payload of '%s'.", exeName, packagePath);
+
+    //recompress the segments whose rows changed, and copy every other segment's compressed bytes verbatim
+    bufferAppend(&newStream, stream.data, ZLIB_HEADER_LENGTH);
+    for (uint32_t s = 0; s < table.count; s++)
+    {
+        int first = s * table.interval,
+            count = height - first < (int)table.interval ? height - first : (int)table.interval;
+        size_t end = s + 1 < table.count ? table.offsets[s + 1] : stream.length - ZLIB_TRAILER_LENGTH;
+        size_t start = table.offsets[s];
+
+        table.offsets[s] = newStream.length;
+        if (s < (uint32_t)segments && memcmp(original + first * stride, decoded + first * stride, count * stride) != 0)
+            table.adlers[s] = compressSegment(rows + first, count, rowlength, channels, filterTypes + first, s + 1 == table.count, &newStream);
+        else
+            bufferAppend(&newStream, stream.data + start, end - start);
+
+        adler = adler32_combine(adler, table.adlers[s], (z_off_t)count * stride);
     }
+    bufferReserve(&newStream, ZLIB_TRAILER_LENGTH);
+    putUint32(newStream.data + newStream.length, (uint32_t)adler);
+    newStream.length += ZLIB_TRAILER_LENGTH;
+    restartEncode(&table, &tableData);
 
-    LOOP_END:
-    if (loggingEnabled)
-        fclose(herpderp);
+    //exit the program if a file already exists at location outputPath, or if a file cannot be created at outputPath
+    if (favailable(outputPath))
+    {
+        if ( !(outputFile = fopen(outputPath, "wb")) )
+            error_(1, "%s: [pngUpdate] Could not create '%s' file.", exeName, outputPath);
+    }
+    else
+        error_(1, "%s: [pngUpdate] file '%s' already exists.", exeName, outputPath);
+
+    //copy everything before IDAT verbatim, write the new IDAT stream, then copy the remaining chunks with a fresh restart table before IEND
+    failed = fwrite(package.data, 1, idatStart, outputFile) != idatStart;
+    for (size_t i = 0; i < newStream.length && !failed; i += IDAT_CHUNK_SIZE)
+        failed = chunkWrite(outputFile, "IDAT", newStream.data + i, newStream.length - i < IDAT_CHUNK_SIZE ? newStream.length - i : IDAT_CHUNK_SIZE);
+    offset = idatEnd;
+    while (!failed && chunkNext(&package, &offset, &chunk) && strcmp(chunk.type, "IEND") != 0)
+        if (strcmp(chunk.type, RESTART_CHUNK) != 0)
+            failed = fwrite(package.data + chunk.offset, 1, chunk.total, outputFile) != chunk.total;
+    if (failed || chunkWrite(outputFile, RESTART_CHUNK, tableData.data, tableData.length) || chunkWrite(outputFile, "IEND", NULL, 0))
+    {
+        fremove(outputFile, outputPath);
+        error_(1, "%s: [pngUpdate] Could not write '%s' file.", exeName, outputPath);
+    }
     fclose(outputFile);
 
+    free(rows);
+    free(filterTypes);
+    free(original);
+    free(decoded);
+    restartFree(&table);
+    bufferFree(&tableData);
+    bufferFree(&newStream);
+    bufferFree(&stream);
+    chunkClose(&package);
+
     return;
 }
\ No newline at end of file
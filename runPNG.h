@@ -3,4 +3,5 @@
 #include <png.h>
 
 void pngEncode(const char *carrierPath, const char *payloadPath, char *outputPath);
-void pngDecode(const char *packagePath, char *outputPath);
\ No newline at end of file
+void pngDecode(const char *packagePath, char *outputPath);
+void pngUpdate(const char *packagePath, const char *payloadPath, char *outputPath);
\ No newline at end of file
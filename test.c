@@ -7,7 +7,8 @@
 
 static int encode = 0;
 static int decode = 0;
-static char *pstr, *kstr;
+static int update = 0;
+static char *pstr, *kstr, *ostr;
 static const char *cstr;
 
 //Prints the Usage message.
@@ -17,16 +18,24 @@ static void printHelp(void)
         "Usage:\n"
         "  %s help\n"
         "    Show this screen.\n\n"
-        "  %s encode (-c|--carrier) <c> (-p|--payload) <p> [-k|--package] <k>\n"
-        "    -c|--carrier <c>\tRequired; PNG file that will hold the specified payload.\n"
+        "  %s encode (-c|--carrier) <c> (-p|--payload) <p> [-k|--package] <k> [-C|--cache] <d> [-r|--restart] <r> [-m|--container]\n"
+        "    -c|--carrier <c>\tRequired; PNG, animated PNG, PPM/PAM or BMP file that will hold the specified payload.\n"
         "    -p|--payload <p>\tRequired; file that will be encoded to the specified carrier.\n"
         "    -k|--package <k>\tOptional; name of file to which to write the resulting package file.\n"
-            "\t\t\t  Default value is 'package'.\n\n"
+            "\t\t\t  Default value is 'package'.\n"
+        "    -C|--cache <d>\tOptional; directory in which to cache decoded carriers for reuse by later jobs.\n"
+        "    -r|--restart <r>\tOptional; restart compression every <r> rows so the package can be updated later.\n"
+        "    -m|--container\tOptional; store the payload in chunks of its own instead of hiding it in the pixel data.\n\n"
         "  %s decode (-k|--package) <k> [-p|--payload] <p>\n"
         "    -k|--package <k>\tRequired; package file containing an encoded payload.\n"
         "    -p|--payload <p>\tOptional; name of file to which to write the read payload.\n"
-            "\t\t\t  Default value is 'payload'.\n",
-        exeName, exeName, exeName
+            "\t\t\t  Default value is 'payload'.\n\n"
+        "  %s update (-k|--package) <k> (-p|--payload) <p> [-o|--output] <o>\n"
+        "    -k|--package <k>\tRequired; package file encoded with -r whose payload will be replaced.\n"
+        "    -p|--payload <p>\tRequired; file that will replace the payload of the specified package.\n"
+        "    -o|--output <o>\tOptional; name of file to which to write the updated package file.\n"
+            "\t\t\t  Default value is the package name followed by '.updated'.\n",
+        exeName, exeName, exeName, exeName
     );
 }
 
@@ -43,10 +52,14 @@ static void readArgs(int argc, char *argv[])
         { "carrier", required_argument, 0, 'c' },
         { "payload", required_argument, 0, 'p' },
         { "package", required_argument, 0, 'k' },
+        { "cache",   required_argument, 0, 'C' },
+        { "restart", required_argument, 0, 'r' },
+        { "output",  required_argument, 0, 'o' },
+        { "container", no_argument,     0, 'm' },
         { 0,         0,                 0,  0  }
     };
     //While there are still options in 'argv' left to process...
-    while ((arg = getopt_long(argc, argv, ":c:p:k:", long_options, &index)) != -1)
+    while ((arg = getopt_long(argc, argv, ":c:p:k:C:r:o:m", long_options, &index)) != -1)
     {
         //...Process option 'arg'.
         switch (arg)
@@ -81,6 +94,41 @@ static void readArgs(int argc, char *argv[])
                     kstr = optarg;
                 //Break out of the switch loop.
                 break;
+            case 'C':
+                //If 'C' is not followed by an argument...
+                if (optarg[0] == '-')
+                    //...roll back 'optind' by 1 (thus ignoring 'C') and trigger a non-fatal error message.
+                    optind--, error_(0, "%s: [readArgs] Option '-C' requires an argument.", exeName);
+                else
+                    //Else, assign the argument following 'C' to 'cacheDir'.
+                    cacheDir = optarg;
+                //Break out of the switch loop.
+                break;
+            case 'r':
+                //If 'r' is not followed by a positive number of rows...
+                if (atoi(optarg) <= 0)
+                    //...trigger a non-fatal error message.
+                    error_(0, "%s: [readArgs] Option '-r' requires a positive number of rows.", exeName);
+                else
+                    //Else, assign the argument following 'r' to 'restartInterval'.
+                    restartInterval = atoi(optarg);
+                //Break out of the switch loop.
+                break;
+            case 'o':
+                //If 'o' is not followed by an argument...
+                if (optarg[0] == '-')
+                    //...roll back 'optind' by 1 (thus ignoring 'o') and trigger a non-fatal error message.
+                    optind--, error_(0, "%s: [readArgs] Option '-o' requires an argument.", exeName);
+                else
+                    //Else, assign the argument following 'o' to 'ostr'.
+                    ostr = optarg;
+                //Break out of the switch loop.
+                break;
+            case 'm':
+                //Store the payload in container chunks instead of the pixel data.
+                containerMode = 1;
+                //Break out of the switch loop.
+                break;
             //If option is missing an argument...
             case ':':
                 //...trigger a non-fatal error message and break the switch loop.
@@ -105,8 +153,8 @@ static void readArgs(int argc, char *argv[])
     {
         //If 'argv[i]' is "encode"...
         if (strcmp(argv[i], "encode") == 0)
-            //If either 'encode' or 'decode' has already been set to 1...
-            if (encode != decode)
+            //If 'encode', 'decode' or 'update' has already been set to 1...
+            if (encode || decode || update)
                 //...trigger a non-fatal error message.
                 error_(0, "%s: [readArgs] Operation mode already defined.", exeName);
             else
@@ -114,13 +162,22 @@ static void readArgs(int argc, char *argv[])
                 encode = 1;
         //...else, if 'argv[i]' is "decode"...
         else if (strcmp(argv[i], "decode") == 0)
-            //If either 'encode' or 'decode' has already been set to 1...
-            if (encode != decode)
+            //If 'encode', 'decode' or 'update' has already been set to 1...
+            if (encode || decode || update)
                 //...trigger a non-fatal error message.
                 error_(0, "%s: [readArgs] Operation mode already defined.", exeName);
             else
                 //Else, set 'decode' to 1.
                 decode = 1;
+        //...else, if 'argv[i]' is "update"...
+        else if (strcmp(argv[i], "update") == 0)
+            //If 'encode', 'decode' or 'update' has already been set to 1...
+            if (encode || decode || update)
+                //...trigger a non-fatal error message.
+                error_(0, "%s: [readArgs] Operation mode already defined.", exeName);
+            else
+                //Else, set 'update' to 1.
+                update = 1;
         //...else, if 'argv[i]' is "help"...
         else if (strcmp(argv[i], "help") == 0)
             //If there are arguments other than the program name and 'help'...
@@ -134,13 +191,13 @@ static void readArgs(int argc, char *argv[])
                 printHelp();
                 exit(EXIT_SUCCESS);
             }
-        //...else, if 'argv[i]' does not match any of the above three conditions...
+        //...else, if 'argv[i]' does not match any of the above four conditions...
         else
             //...ignore 'argv[i]' and trigger a non-fatal error message.
             error_(0, "%s: [readArgs] Unknown argument '%s'. Will be discarded.", exeName, argv[i]);
     }
-    //If neither 'encode' nor 'decode' was set to 1...
-    if (encode == decode)
+    //If none of 'encode', 'decode' and 'update' was set to 1...
+    if (!encode && !decode && !update)
         //...trigger a fatal error message.
         error_(1, "%s: [readArgs] Operation mode undefined.", exeName);
 }
@@ -187,7 +244,29 @@ static void hasReqOpts (void)
             //...use the default char array "payload".
             pstr = "payload";
     }
-    //...else, if the selected mode is somehow neither "encode" nor "decode"...
+    //...else, if the selected mode is "update"...
+    else if (update)
+    {
+        //...and if 'kstr' has not been set...
+        if (!kstr)
+        {
+            //...trigger a non-fatal error message and indicate that not all required options are set.
+            error_(0, "%s: [hasReqOpts] -k/--package is required for mode 'update'.", exeName);
+            haveAllOpts = 0;
+        }
+        //...and if 'pstr' has not been set...
+        if (!pstr)
+        {
+            //...trigger a non-fatal error message and indicate that not all required options are set.
+            error_(0, "%s: [hasReqOpts] -p/--payload is required for mode 'update'.", exeName);
+            haveAllOpts = 0;
+        }
+        //If 'ostr' has not been set and 'kstr' has...
+        if (!ostr && kstr)
+            //...use the package name followed by ".updated".
+            ostr = faddExt(kstr, ".updated");
+    }
+    //...else, if the selected mode is somehow neither "encode", "decode" nor "update"...
     else
         //...trigger a fatal error message.
         error_(1, "%s: [hasReqOpts] Operation mode undefined.", exeName);
@@ -223,7 +302,17 @@ static void checkFiles(void)
         'reqFilesExist' will be set to 1.*/
         requFilesExist = (packageResult == 0);
     }
-    //...else, if the selected mode is somehow neither "encode" nor "decode"...
+    //...else, if the selected mode is "update"...
+    else if (update)
+    {
+        int packageResult = fexist(kstr, "package");
+        int payloadResult = fexist(pstr, "payload");
+
+        /*If both the specified package and payload files exist,
+        'reqFilesExist' will be set to 1.*/
+        requFilesExist = !packageResult && !payloadResult;
+    }
+    //...else, if the selected mode is somehow neither "encode", "decode" nor "update"...
     else
         //...trigger a fatal error message.
         error_(1, "%s: [checkFiles] Operation mode undefined.", exeName);
@@ -245,7 +334,11 @@ static void runType()
     else if (decode)
         //run the decode function
         return pngDecode((const char *)kstr, pstr);
-    //...else, if the selected mode is somehow neither "encode" nor "decode"...
+    //...else, if the selected mode is "update"...
+    else if (update)
+        //run the update function
+        return pngUpdate((const char *)kstr, (const char *)pstr, ostr);
+    //...else, if the selected mode is somehow neither "encode", "decode" nor "update"...
     else
         //...trigger a fatal error message.
         error_(1, "%s: [runType] Operation mode undefined.", exeName);